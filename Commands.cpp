@@ -1,870 +1,3373 @@
-#include <unistd.h>
-#include <string.h>
-#include <iostream>
-#include <vector>
-#include <sstream>
-#include <sys/wait.h>
-#include <iomanip>
-#include "Commands.h"
-#include <algorithm>
-#include <fcntl.h>
-#include <fstream>
-#include <sched.h>
-#include <sys/sysinfo.h>
-
-
-using namespace std;
-
-const std::string WHITESPACE = " \n\r\t\f\v";
-
-#if 0
-#define FUNC_ENTRY()  \
-  cout << __PRETTY_FUNCTION__ << " --> " << endl;
-
-#define FUNC_EXIT()  \
-  cout << __PRETTY_FUNCTION__ << " <-- " << endl;
-#else
-#define FUNC_ENTRY()
-#define FUNC_EXIT()
-#endif
-
-string _ltrim(const std::string& s)
-{
-  size_t start = s.find_first_not_of(WHITESPACE);
-  return (start == std::string::npos) ? "" : s.substr(start);
-}
-
-string _rtrim(const std::string& s)
-{
-  size_t end = s.find_last_not_of(WHITESPACE);
-  return (end == std::string::npos) ? "" : s.substr(0, end + 1);
-}
-
-string _trim(const std::string& s)
-{
-  return _rtrim(_ltrim(s));
-}
-
-int _parseCommandLine(const char* cmd_line, char** args) {
-  FUNC_ENTRY()
-  int i = 0;
-  std::istringstream iss(_trim(string(cmd_line)).c_str());
-  for(std::string s; iss >> s; ) {
-    args[i] = (char*)malloc(s.length()+1);
-    memset(args[i], 0, s.length()+1);
-    strcpy(args[i], s.c_str());
-    args[++i] = NULL;
-  }
-  return i;
-
-  FUNC_EXIT()
-}
-
-bool _isBackgroundComamnd(const char* cmd_line) {
-  const string str(cmd_line);
-  return str[str.find_last_not_of(WHITESPACE)] == '&';
-}
-
-void _removeBackgroundSign(char* cmd_line) {
-  const string str(cmd_line);
-  // find last character other than spaces
-  unsigned int idx = str.find_last_not_of(WHITESPACE);
-  // if all characters are spaces then return
-  if (idx == string::npos) {
-    return;
-  }
-  // if the command line does not end with & then return
-  if (cmd_line[idx] != '&') {
-    return;
-  }
-  // replace the & (background sign) with space and then remove all tailing spaces.
-  cmd_line[idx] = ' ';
-  // truncate the command line string up to the last non-space character
-  cmd_line[str.find_last_not_of(WHITESPACE, idx) + 1] = 0;
-}
-
-// TODO: Add your implementation for classes in Commands.h 
-Command::Command(const char* cmd_line) : original_cmd_line(cmd_line),
-  cmd_line(cmd_line), args(), num_of_args(), is_background(false) {
-  prepare();
-}
-
-Command::~Command() {
-  for (int i = 0; i < num_of_args; i++) {
-    free(args[i]);
-    args[i] = nullptr;
-  }
-  free(args);
-  args = nullptr;
-}
-
-void Command::prepare() {
-  if (_isBackgroundComamnd(cmd_line.c_str())) {
-    is_background = true;
-    char temp_cmd_line[COMMAND_ARGS_MAX_LENGTH + 1];
-    strcpy(temp_cmd_line, cmd_line.c_str());
-    _removeBackgroundSign(temp_cmd_line);
-    cmd_line = _trim(std::string(temp_cmd_line));
-  }
-  args = (char **)malloc(sizeof(char*) * COMMAND_MAX_ARGS);
-  num_of_args = _parseCommandLine(cmd_line.c_str(), args);
-}
-
-BuiltInCommand::BuiltInCommand(const char* cmd_line) : Command(cmd_line) {
-  is_background = false;
-}
-
-ExternalCommand::ExternalCommand(const char* cmd_line) : Command(cmd_line), is_complex(false) {
-  if (this->cmd_line.find('*') != std::string::npos || this->cmd_line.find('?') != std::string::npos) {
-    is_complex = true;
-  }
-}
-
-void ExternalCommand::execute() {
-  if (is_complex){
-    char cmd_line_copy[201];
-    strcpy(cmd_line_copy, cmd_line.c_str());
-    char* ext_cmd[4];
-    ext_cmd[0] = strdup("bash");
-    ext_cmd[1] = strdup("-c");
-    ext_cmd[2] = cmd_line_copy;
-    ext_cmd[3] = nullptr;
-    execvp("/bin/bash", ext_cmd);
-
-  }
-  else{
-    execvp(this->args[0], args);
-    // If failed search in /bin/
-    string command = "/bin/" + string(this->args[0]);
-    execvp(command.c_str(), args);
-  }
-  // If failed print error message
-  perror("smash error: execvp failed");
-  exit(0);
-}
-
-ChangePrompt::ChangePrompt(const char* cmd_line) : BuiltInCommand(cmd_line), title("smash") {
-  if (num_of_args < 2) return;
-  title = args[1];
-}
-
-void ChangePrompt::execute() {
-  SmallShell& smash = SmallShell::getInstance();
-  smash.changeTitle(title);
-}
-
-void ShowPidCommand::execute() {
-  cout << "smash pid is " << getpid() << endl;
-}
-
-void GetCurrDirCommand::execute() {
-  char* cwd = getcwd(nullptr, 0);
-  cout << cwd << endl;
-  free(cwd);
-}
-
-void ChangeDirCommand::execute() {
-  if (num_of_args < 2){
-    std::string errormessage = "smash error:> \"";
-    errormessage = errormessage + this->original_cmd_line + "\"";
-    cout << errormessage << endl;
-    return;
-  }
-  if (num_of_args > 2) {
-    cerr << "smash error: cd: too many arguments" << endl;
-    return;
-  }
-
-  char* cwd = getcwd(nullptr, 0);
-  if(cwd == 0){
-    perror("smash error: getcwd failed");
-    return;
-  }
-  SmallShell& smash = SmallShell::getInstance();
-  if (strcmp(args[1], "-") == 0) {
-    string new_wd = smash.getLastWD();
-    if (new_wd.empty()) {
-      free(cwd);
-      cerr << "smash error: cd: OLDPWD not set" << endl;
-      return;
-    }
-    if (chdir(new_wd.c_str()) != 0) {
-      free(cwd);
-      perror("smash error: chdir failed");
-      return;
-    }
-  }
-  else if (chdir(args[1]) != 0) {
-    free(cwd);
-    perror("smash error: chdir failed");
-    return;
-  }
-
-  smash.setLastWD(cwd);
-  free(cwd);
-}
-
-void JobsCommand::execute() {
-  SmallShell::getInstance().job_list.printJobsList();
-}
-
-void ForegroundCommand::execute() {
-  if (num_of_args > 2) {
-    cerr << "smash error: fg: invalid arguments" << endl;
-    return;
-  }
-
-  int target_id;
-  JobsList::JobEntry* target_job;
-  SmallShell& smash = SmallShell::getInstance();
-  if (num_of_args == 2) {
-    try {
-      target_id = stoi(args[1]);
-    } catch (...) {
-      cerr << "smash error: fg: invalid arguments" << endl;
-      return;
-    }
-    target_job = smash.job_list.getJobById(target_id);
-    if (target_job == nullptr) {
-      string err = "smash error: fg: job-id " + string(args[1]) + " does not exist";
-      cerr << err.c_str() << endl;
-      return;
-    }
-  } else {
-      target_job = smash.job_list.getLastJob(&target_id);
-      if (target_job == nullptr) {
-        cerr << "smash error: fg: jobs list is empty" << endl;
-        return;
-      }
-  }
-
-  cout << target_job->cmd->original_cmd_line << " : " << target_job->pid << endl;
-
-  smash.fg_job = new JobsList::JobEntry(target_id, target_job->cmd, target_job->pid);
-  smash.job_list.removeJobById(target_id);
-  if(kill(smash.fg_job->pid, SIGCONT) == -1){
-    perror("smash error: kill failed");
-  }
-  waitpid(smash.fg_job->pid, nullptr, WUNTRACED);
-  delete smash.fg_job;
-  smash.fg_job = nullptr;
-}
-
-void FareCommand::execute(){
-  if (num_of_args != 4){
-    cerr << "smash error: fare: invalid arguments" << endl;
-    return;
-  }
-  
-  string file_name = args[1];
-  string src = args[2];
-  string dst = args[3];
-
-  FILE *file = fopen(file_name.c_str(), "r+");
-  if (file == NULL){
-    perror("smash error: open failed");
-    return;
-  } 
-  fclose(file);
-
-  std::stringstream buffer;
-  try{
-    std::ifstream in(file_name);
-    buffer << in.rdbuf();
-    in.close();
-  }
-  catch(...){
-    perror("smash error: open failed");
-    return;
-  }
-
-  string file_content = buffer.str();
-  int times = ReplaceSubStrings(file_content, src, dst);
-
-  try{
-    std::ofstream out(file_name, std::ofstream::trunc);
-    out << file_content;
-    out.close();
-  }
-  catch(...){
-    perror("smash error: open failed");
-    return;
-  }
-
-  cout << "replaced " <<  times << " instances of the string \"" << src << "\"" << endl;
-}
-
-int FareCommand::ReplaceSubStrings(std::string& str, const std::string& from, const std::string& to) {
-    size_t start_pos = 0;
-    int counter = 0;
-    while((start_pos = str.find(from, start_pos)) != std::string::npos) {
-        str.replace(start_pos, from.length(), to);
-        start_pos += to.length(); // Handles case where 'to' is a substring of 'from'
-        counter++;
-    }
-    return counter;
-}
-
-void KillCommand::execute() {
-  if (num_of_args != 3){
-    cerr << "smash error: kill: invalid arguments" << endl;
-    return;
-  }
-  int signum;
-  int job_id;
-  try {
-    signum = -1 * stoi(args[1]);
-    job_id = stoi(args[2]);
-  } catch (...) {
-    cerr << "smash error: kill: invalid arguments" << endl;
-    return;
-  }
-  if (!(signum >= 1 && signum <= 31)) {
-    cerr << "smash error: kill: invalid arguments" << endl;
-    return;
-  }
-  JobsList::JobEntry* job = jobs_list->getJobById(job_id);
-  if (job == nullptr) {
-    cerr << "smash error: kill: job-id " << job_id << " does not exist" << endl;
-    return;
-  }
-  int pid = job->pid;
-  switch (signum) {
-    case SIGCONT:
-      if (kill(pid, SIGCONT) == -1) {
-        perror("smash error: kill failed");
-        return;
-      }
-      job->is_stopped = false;
-      break;
-    case SIGSTOP:
-      if (kill(pid, SIGSTOP) == -1) {
-        perror("smash error: kill failed");
-        return;
-      }
-      job->is_stopped = true;
-      break;
-    case SIGKILL:
-      if (kill(pid, SIGKILL) == -1) {
-        perror("smash error: kill failed");
-        return;
-      }
-      break;
-    case SIGTERM:
-      if (kill(pid, SIGTERM) == -1) {
-        perror("smash error: kill failed");
-        return;
-      }
-      break;
-    default:
-      if (kill(pid, signum) == -1) {
-        perror("smash error: kill failed");
-        return;
-      }
-  }
-  cout << "signal number " << signum << " was sent to pid " << pid << endl;
-}
-
-void BackgroundCommand::execute() {
-  if (num_of_args > 2) {
-    cerr << "smash error: bg: invalid arguments" << endl;
-    return;
-  }
-
-  int target_id;
-  JobsList::JobEntry* target_job;
-  SmallShell& smash = SmallShell::getInstance();
-  if (num_of_args == 2) {
-    try {
-      target_id = stoi(args[1]);
-    } catch (...) {
-      cerr << "smash error: bg: invalid arguments" << endl;
-      return;
-    }
-    target_job = smash.job_list.getJobById(target_id);
-    if (target_job == nullptr) {
-      string err = "smash error: bg: job-id " + string(args[1]) + " does not exist";
-      cerr << err.c_str() << endl;
-      return;
-    }
-    else if (target_job->is_stopped == 0) {
-      string err = "smash error: bg: job-id " + string(args[1]) + " is already running in the background";
-      cerr << err.c_str() << endl;
-      return;
-    }
-  } else {
-      target_job = smash.job_list.getLastStoppedJob(&target_id);
-      if (target_job == nullptr) {
-        cerr << "smash error: bg: there is no stopped jobs to resume" << endl;
-        return;
-      }
-  }
-
-  cout << target_job->cmd->original_cmd_line << " : " << target_job->pid << endl;
-  target_job->is_stopped = false;
-  if(kill(target_job->pid, SIGCONT) == -1){
-    perror("smash error: kill failed");
-  }
-}
-
-void QuitCommand::execute() {
-  bool is_kill = false;
-  for (int i = 1; i < num_of_args; i++) {
-    if (strcmp("kill", args[i]) == 0) {
-      is_kill = true;
-    }
-  }
-  if (is_kill) {
-    SmallShell::getInstance().job_list.killAllJobs();
-    SmallShell::getInstance().job_list.removeFinishedJobs();
-  } 
-  exit(0);
-}
-
-PipeCommand::PipeCommand(const char* cmd_line) : Command(cmd_line), to_cerr(true){
-  string type = "|&";
-  auto i = this->cmd_line.find("|&");
-  if (i == string::npos) {
-    to_cerr = false;
-    type = "|";
-    i = this->cmd_line.find("|");
-  }
-  first_cmd = SmallShell::getInstance().CreateCommand((this->cmd_line.substr(0, i)).c_str());
-  second_cmd = SmallShell::getInstance().CreateCommand(this->cmd_line.substr(i + type.length() , string::npos).c_str());
-} 
-
-void PipeCommand::execute(){
-  int new_pipe[2];
-  int success = pipe(new_pipe);
-  if(success != 0){
-    cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
-    return;
-  }
-
-  pid_t pid1 = fork();
-  if(pid1 == -1){
-    perror("smash error: fork failed");
-    close(new_pipe[0]);
-    close(new_pipe[1]);
-    return;
-  }
-  else if(pid1 == 0){
-    setpgrp();
-    if(to_cerr){
-      dup2(new_pipe[1], 2);
-      close(new_pipe[0]);
-      close(new_pipe[1]);
-    }
-    else{
-      dup2(new_pipe[1], 1);
-      close(new_pipe[0]);
-      close(new_pipe[1]);
-    }
-    this->first_cmd->execute();
-    exit(0);
-  }
-
-  pid_t pid2 = fork();
-  if(pid2 == -1){
-    perror("smash error: fork failed");
-    close(new_pipe[0]);
-    close(new_pipe[1]);
-    return;
-  }
-  else if(pid2 == 0){
-    setpgrp();
-    dup2(new_pipe[0], 0);
-    close(new_pipe[0]);
-    close(new_pipe[1]);
-    this->second_cmd->execute();
-    exit(0);
-  }
-  close(new_pipe[0]);
-  close(new_pipe[1]);
-
-  waitpid(pid1, nullptr, 0);
-  waitpid(pid2, nullptr, 0);
-}
-
-RedirectionCommand::RedirectionCommand(const char* cmd_line) : 
-  Command(cmd_line) , output_file(), is_append(true) {
-  string type = ">>";
-  auto i = this->cmd_line.find(">>");
-  if (i == string::npos) {
-    is_append = false;
-    type = ">";
-    i = this->cmd_line.find(">");
-  }
-  char temp_cmd_line[COMMAND_ARGS_MAX_LENGTH + 1];
-  strcpy(temp_cmd_line, this->cmd_line.substr(0, i).c_str());
-  _removeBackgroundSign(temp_cmd_line);
-  cmd = temp_cmd_line;
-  output_file = _trim(this->cmd_line.substr(i + type.length() , string::npos));
-} 
-
-void RedirectionCommand::execute(){
-  int flag = O_CREAT | O_TRUNC | O_RDWR;
-  if(this->is_append){
-    flag = O_CREAT | O_APPEND | O_RDWR;
-  }
-	int old_stdout = dup(1);
-	close(1);
-  int fd = open(this->output_file.c_str(), flag, S_IRWXU | S_IRWXO | S_IRWXG);
-  if(fd == -1){
-    perror("smash error: open failed");
-    dup2(old_stdout, 1);
-    close(old_stdout);
-    return;
-  }
-	SmallShell::getInstance().executeCommand(cmd.c_str());
-  close(fd);
-	dup2(old_stdout, 1);
-  close(old_stdout);
-}
-
-void SetcoreCommand::execute(){
-  if (num_of_args != 3){
-    cerr << "smash error: setcore: invalid arguments" << endl;
-    return;
-  }
-  int corenum;
-  int job_id;
-  pid_t pid;
-  try {
-    corenum = stoi(args[2]);
-    job_id = stoi(args[1]);
-  } catch (...) {
-    cerr << "smash error: setcore: invalid arguments" << endl;
-    return;
-  }
-  JobsList::JobEntry* job = SmallShell::getInstance().job_list.getJobById(job_id);
-  if(job == nullptr) {
-    cerr << "smash error: setcore: job-id " << job_id << " does not exist" << endl;
-    return;
-  }
-  pid = job->pid;
-  if(corenum < 0 || corenum >= get_nprocs_conf()){
-    cerr << "smash error: setcore: invalid core number" << endl;
-    return;
-  }
-  cpu_set_t my_set;        /* Define your cpu_set bit mask. */
-  CPU_ZERO(&my_set);       /* Initialize it all to 0, i.e. no CPUs selected. */
-  CPU_SET(corenum, &my_set);     /* set the bit that represents core corenum. */
-  /* Set affinity of pid  to the defined mask, i.e. only corenum. */
-  if (sched_setaffinity(pid, sizeof(cpu_set_t), &my_set) == -1) {
-    perror("smash error: sched_setaffinity failed");
-  }
-}
-
-void TimeoutCommand::timed_execute(shared_ptr<Command> cmd_ptr) {
-  if (num_of_args <= 2) {
-    // cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
-    cerr << "smash error: " << "timeout: "<< "invalid arguments" << endl;
-    return;
-  }
-  int secs;
-  try {
-      secs = stoi(args[1]);
-  } catch (...) {
-      // cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
-      cerr << "smash error: " << "timeout: "<< "invalid arguments" << endl;
-      return;
-  }
-  if (secs <= 0 ) {
-    // cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
-    cerr << "smash error: " << "timeout: "<< "invalid arguments" << endl;
-    return;
-  }
-  SmallShell& smash = SmallShell::getInstance();
-
-  auto sec_pos = this->cmd_line.find(args[1]);
-  std::shared_ptr<Command> internal_cmd = smash.CreateCommand(
-    this->original_cmd_line.substr(sec_pos + string(args[1]).length() , string::npos).c_str());
-  
-  // Execution
-  pid_t pid = fork();
-  if(pid == -1){
-    perror("smash error: fork failed");
-    return;
-  }
-  else if(pid == 0){
-    setpgrp();
-    internal_cmd->execute();
-  }
-  else{
-    shared_ptr<JobsList::JobEntry> timed_job(new JobsList::JobEntry(0, cmd_ptr, pid));
-    smash.timed_jobs.addTimedJob(time(0) + secs, timed_job);
-
-    if (internal_cmd->is_background) {
-      smash.job_list.removeFinishedJobs();
-      smash.job_list.addJob(cmd_ptr, pid, false);
-    }
-    else{
-      smash.fg_job = new JobsList::JobEntry(0, cmd_ptr, pid);
-      waitpid(pid, nullptr, WUNTRACED);
-      delete smash.fg_job;
-      smash.fg_job = nullptr;
-    }
-  }
-}
-
-void TimedJobsList::addTimedJob(time_t end_time, shared_ptr<JobsList::JobEntry> job) {
-  if (jobs.find(end_time) != jobs.end()) {
-      jobs[end_time].push_back(job);
-  }
-  else {
-      jobs.insert({end_time, {job}});
-  }
-
-  // Create alarm for first object
-  auto it = jobs.begin();
-  if (it != jobs.end()) {
-    alarm(it->first - time(0));
-  }
-}
-
-void TimedJobsList::handleAlarm() {
-  time_t curr = time(0);
-  auto jobs_vec = jobs.find(curr);
-  if (jobs_vec != jobs.end())
-  {
-    auto job = jobs_vec->second.begin();
-    while (job != jobs_vec->second.end()) {
-      if (waitpid((*job)->pid, nullptr, WNOHANG) == 0) {
-        if (kill((*job)->pid, SIGKILL) == -1) {
-          perror("smash error: kill failed");
-        } 
-        cout << "smash: " << (*job)->cmd->original_cmd_line << " timed out!" << endl;
-      }
-      job++;
-    }
-    jobs_vec->second.clear();
-    jobs.erase(jobs_vec);
-
-    // Restore alarm for next job in line
-    auto it = jobs.begin();
-    if (it != jobs.end()) {
-      alarm(it->first - time(0));
-    }
-  }
-}
-
-void JobsList::addJob(std::shared_ptr<Command> cmd, int pid, bool isStopped, int job_id) {
-  int next_id;
-  auto it = max_element(jobs.begin(),
-                             jobs.end(),
-                             [](const JobEntry& a,const JobEntry& b) { return a.job_id < b.job_id; });                 
-  if (it == jobs.end()) {
-    next_id = 1;
-  } else {
-      next_id = it->job_id + 1;
-  }
-  next_id = job_id == 0 ? next_id : job_id;
-  jobs.push_back(JobEntry(next_id, cmd, pid, isStopped));
-}
-
-void JobsList::printJobsList() {
-  std::sort(jobs.begin(), jobs.end(), 
-      [](const JobEntry& a,const JobEntry& b) { return a.job_id < b.job_id; });
-
-  auto job = jobs.begin();
-  while (job != jobs.end()) {
-    string job_print = "[" + to_string(job->job_id) + "] ";
-    job_print += job->cmd->original_cmd_line + " : ";
-    job_print += to_string(job->pid) + " ";
-    string stime = to_string(int(difftime(time(0), job->time_started)));
-    job_print +=  stime + " secs";
-    if (job->is_stopped)
-      job_print += " (stopped)";
-    cout << job_print << endl;
-    job++;
-  }
-}
-
-void JobsList::removeFinishedJobs() {
-  auto job = jobs.begin();
-  while (job != jobs.end()) {
-    if (waitpid(job->pid, nullptr, WNOHANG) != 0) {
-      job = jobs.erase(job);
-    } else {
-      job++;
-    }
-  }
-}
-
-void JobsList::killAllJobs() {
-  removeFinishedJobs();
-  std::sort(jobs.begin(), jobs.end(), 
-      [](const JobEntry& a,const JobEntry& b) { return a.job_id < b.job_id; });
-    int size = jobs.size();
-    cout << "smash: sending SIGKILL signal to " << size << " jobs:" << endl;
-    for (int i = 0; i < size; i++) {
-      cout << jobs[i].pid << ": " << jobs[i].cmd->original_cmd_line << endl; 
-      if (kill(jobs[i].pid, 9) == -1){
-        perror("smash error: kill failed");
-      }
-    }
-}
-
-JobsList::JobEntry* JobsList::getJobById(int jobId) {
-  removeFinishedJobs();
-  for (size_t i = 0; i < jobs.size(); i++) {
-    if (jobs[i].job_id == jobId) {
-      return &jobs[i];
-    }
-  }
-  return nullptr;
-}
-
-void JobsList::removeJobById(int jobId) {
-  auto job = jobs.begin();
-  while (job != jobs.end()) {
-    if (job->job_id == jobId) {
-      jobs.erase(job);
-      return;
-    }
-    job++;
-  }
-}
-
-JobsList::JobEntry* JobsList::getLastJob(int* lastJobId) {
-  removeFinishedJobs();
-  auto it = max_element(jobs.begin(),
-                             jobs.end(),
-                             [](const JobEntry& a,const JobEntry& b) { return a.job_id < b.job_id; });
-  if (it == jobs.end()) {
-    *lastJobId = -1;
-    return nullptr;
-  }
-  *lastJobId = it->job_id;
-  return &(*it);
-}
-
-JobsList::JobEntry* JobsList::getLastStoppedJob(int* lastJobId) {
-  removeFinishedJobs();
-  vector<JobEntry> stopped_jobs;
-  auto job = jobs.begin();
-  while (job != jobs.end()) {
-    if (job->is_stopped) {
-      stopped_jobs.push_back(*job);
-    }
-    job++;
-  }
-
-  auto it = max_element(stopped_jobs.begin(),
-                             stopped_jobs.end(),
-                             [](const JobEntry& a,const JobEntry& b) { return a.job_id < b.job_id; });
-  if (it == stopped_jobs.end()) {
-    *lastJobId = -1;
-    return nullptr;
-  }
-  *lastJobId = it->job_id;
-  return getJobById(it->job_id);
-}
-
-SmallShell::SmallShell() : title("smash"), last_wd(), job_list(), timed_jobs(), fg_job() {}
-
-void SmallShell::changeTitle(const string& title) {
-  this->title = title;
-}
-
-void SmallShell::setLastWD(char* new_lwd) {
-  this->last_wd = string(new_lwd);
-}
-
-SmallShell::~SmallShell() {
-}
-
-/**
-* Creates and returns a pointer to Command class which matches the given command line (cmd_line)
-*/
-shared_ptr<Command> SmallShell::CreateCommand(const char* cmd_line) {
-
-  string cmd_s = _trim(string(cmd_line));
-  string firstWord = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
-
-  if (cmd_s.find(">>") != string::npos || cmd_s.find(">") != string::npos) {
-    return shared_ptr<RedirectionCommand>(new RedirectionCommand(cmd_line));
-  }
-  else if (cmd_s.find("|&") != string::npos || cmd_s.find("|") != string::npos) {
-    return shared_ptr<PipeCommand>(new PipeCommand(cmd_line));
-  }
-  else if (firstWord.compare("timeout") == 0) {
-    return shared_ptr<TimeoutCommand>(new TimeoutCommand(cmd_line));
-  }
-  else if (firstWord.compare("setcore") == 0) {
-    return shared_ptr<SetcoreCommand>(new SetcoreCommand(cmd_line));
-  }
-  else if (firstWord.compare("chprompt") == 0) {
-    return shared_ptr<ChangePrompt>(new ChangePrompt(cmd_line));
-  }
-  else if (firstWord.compare("showpid") == 0) {
-    return shared_ptr<ShowPidCommand>(new ShowPidCommand(cmd_line));
-  }
-  else if (firstWord.compare("pwd") == 0) {
-    return shared_ptr<GetCurrDirCommand>(new GetCurrDirCommand(cmd_line));
-  }
-  else if (firstWord.compare("cd") == 0) {
-    return shared_ptr<ChangeDirCommand>(new ChangeDirCommand(cmd_line));
-  }
-  else if(firstWord.compare("jobs") == 0) {
-    return shared_ptr<JobsCommand>(new JobsCommand(cmd_line, &job_list));
-  }
-  else if(firstWord.compare("fg") == 0) {
-    return shared_ptr<ForegroundCommand>(new ForegroundCommand(cmd_line, &job_list));
-  }
-  else if(firstWord.compare("bg") == 0) {
-    return shared_ptr<BackgroundCommand>(new BackgroundCommand(cmd_line, &job_list));
-  }
-  else if(firstWord.compare("quit") == 0) {
-    return shared_ptr<QuitCommand>(new QuitCommand(cmd_line, &job_list));
-  }
-  else if(firstWord.compare("kill") == 0) {
-   return shared_ptr<KillCommand>(new KillCommand(cmd_line, &job_list));
-  }
-  else if(firstWord.compare("fare") == 0) {
-    return shared_ptr<FareCommand>(new FareCommand(cmd_line));
-  }
-  else {
-    return shared_ptr<ExternalCommand>(new ExternalCommand(cmd_line));
-  }
-  return nullptr;
-}
-
-void SmallShell::executeCommand(const char *cmd_line) {
-  shared_ptr<Command> cmd = CreateCommand(cmd_line);
-  if (cmd == nullptr) return;
-  ExternalCommand* ext_cmd = dynamic_cast<ExternalCommand*>(cmd.get());
-  TimeoutCommand* timed_cmd = dynamic_cast<TimeoutCommand*>(cmd.get());
-  if (timed_cmd){
-    timed_cmd->timed_execute(cmd);
-    return;
-  }
-  if (!ext_cmd){
-    cmd->execute();
-    return;
-  }
-  else{
-    pid_t pid = fork();
-    if(pid == -1){
-      perror("smash error: fork failed");
-      return;
-    }
-    else if(pid == 0){
-      setpgrp();
-      ext_cmd->execute();
-    }
-    else{
-      if (ext_cmd->is_background){
-        job_list.removeFinishedJobs();
-        job_list.addJob(cmd, pid, false);
-      }
-      else{
-        fg_job = new JobsList::JobEntry(0, cmd, pid);
-        waitpid(pid, nullptr, WUNTRACED);
-        delete fg_job;
-        fg_job = nullptr;
-      }
-    }
-  }
-}
\ No newline at end of file
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+#include <sys/wait.h>
+#include <iomanip>
+#include "Commands.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/sysinfo.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <thread>
+#include <chrono>
+#include <system_error>
+#include <atomic>
+#include <math.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <type_traits>
+#include <dlfcn.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <sstream>
+
+
+using namespace std;
+
+const std::string WHITESPACE = " \n\r\t\f\v";
+// Characters smash does not interpret itself, commands using them with wildcards go to bash
+const std::string SHELL_SYNTAX = "'\"\\$`;(){}~";
+
+#if 0
+#define FUNC_ENTRY()  \
+  cout << __PRETTY_FUNCTION__ << " --> " << endl;
+
+#define FUNC_EXIT()  \
+  cout << __PRETTY_FUNCTION__ << " <-- " << endl;
+#else
+#define FUNC_ENTRY()
+#define FUNC_EXIT()
+#endif
+
+string _ltrim(const std::string& s)
+{
+  size_t start = s.find_first_not_of(WHITESPACE);
+  return (start == std::string::npos) ? "" : s.substr(start);
+}
+
+string _rtrim(const std::string& s)
+{
+  size_t end = s.find_last_not_of(WHITESPACE);
+  return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+}
+
+string _trim(const std::string& s)
+{
+  return _rtrim(_ltrim(s));
+}
+
+/**
+* Splits arena in place: every separator after a token becomes '\0' and argv gets a pointer
+* to the start of each token, followed by a terminating NULL. The tokens stay valid as long
+* as arena is not modified, and argv.data() can be handed to exec as is.
+*/
+int _parseCommandLine(std::string& arena, std::vector<char*>& argv) {
+  FUNC_ENTRY()
+  argv.clear();
+  char* data = &arena[0];
+  size_t length = arena.length();
+  size_t i = 0;
+  while (i < length) {
+    while (i < length && isspace((unsigned char)data[i])) i++;
+    if (i == length) break;
+    argv.push_back(data + i);
+    while (i < length && !isspace((unsigned char)data[i])) i++;
+    if (i < length) data[i++] = '\0';
+  }
+  argv.push_back(nullptr);
+  return argv.size() - 1;
+
+  FUNC_EXIT()
+}
+
+bool _isBackgroundComamnd(const std::string& cmd_line) {
+  size_t idx = cmd_line.find_last_not_of(WHITESPACE);
+  return idx != string::npos && cmd_line[idx] == '&';
+}
+
+void _removeBackgroundSign(std::string& cmd_line) {
+  // find last character other than spaces
+  size_t idx = cmd_line.find_last_not_of(WHITESPACE);
+  // if all characters are spaces or the command line does not end with & then return
+  if (idx == string::npos || cmd_line[idx] != '&') {
+    return;
+  }
+  // drop the & (background sign) and then remove all tailing spaces.
+  cmd_line.erase(idx);
+  size_t end = cmd_line.find_last_not_of(WHITESPACE);
+  cmd_line.erase(end == string::npos ? 0 : end + 1);
+}
+
+/**
+* Every builtin as (name, class, policy). Adding a builtin is one line here; a class whose
+* constructor also takes a JobsList* gets the shell's job list.
+*/
+#define SMASH_BUILTINS(X) \
+  X(timeout,  TimeoutCommand,    RUN_TIMED) \
+  X(time,     TimeCommand,       RUN_WRAPPER) \
+  X(setcore,  SetcoreCommand,    RUN_IN_PARENT) \
+  X(chprompt, ChangePrompt,      RUN_IN_PARENT) \
+  X(showpid,  ShowPidCommand,    RUN_IN_PARENT) \
+  X(pwd,      GetCurrDirCommand, RUN_IN_PARENT) \
+  X(cd,       ChangeDirCommand,  RUN_IN_PARENT) \
+  X(jobs,     JobsCommand,       RUN_IN_PARENT) \
+  X(fg,       ForegroundCommand, RUN_IN_PARENT) \
+  X(bg,       BackgroundCommand, RUN_IN_PARENT) \
+  X(quit,     QuitCommand,       RUN_IN_PARENT) \
+  X(kill,     KillCommand,       RUN_IN_PARENT) \
+  X(hash,     HashCommand,       RUN_IN_PARENT) \
+  X(cmdcache, CmdCacheCommand,   RUN_IN_PARENT) \
+  X(fare,     FareCommand,       RUN_IN_PARENT) \
+  X(enable,   EnableCommand,     RUN_IN_PARENT) \
+  X(pipebench, PipeBenchCommand, RUN_IN_PARENT) \
+  X(trace,    TraceCommand,      RUN_IN_PARENT) \
+  X(stats,    StatsCommand,      RUN_IN_PARENT)
+
+// Builtins standing in for utilities, same format; SMASH_COREUTILS=external runs the binaries instead
+#define SMASH_NATIVE_UTILS(X) \
+  X(echo,     EchoCommand,       RUN_IN_PARENT) \
+  X(true,     TrueCommand,       RUN_IN_PARENT) \
+  X(test,     TestCommand,       RUN_IN_PARENT) \
+  X(cat,      CatCommand,        RUN_FORKED) \
+  X(sleep,    SleepCommand,      RUN_FORKED)
+
+struct BuiltinEntry {
+  const char* name;
+  Command* (*create)(const CommandPlan& plan);
+  CommandPlan::Policy policy;
+  bool is_native_util;
+};
+
+template <class T>
+static typename std::enable_if<std::is_constructible<T, const CommandPlan&, JobsList*>::value, Command*>::type
+_makeCommand(const CommandPlan& plan) {
+  return new T(plan, &SmallShell::getInstance().job_list);
+}
+
+template <class T>
+static typename std::enable_if<!std::is_constructible<T, const CommandPlan&, JobsList*>::value, Command*>::type
+_makeCommand(const CommandPlan& plan) {
+  return new T(plan);
+}
+
+#define SMASH_BUILTIN_ENTRY(name, type, policy) \
+  static const BuiltinEntry builtin_##name = {#name, &_makeCommand<type>, CommandPlan::policy, false};
+#define SMASH_NATIVE_UTIL_ENTRY(name, type, policy) \
+  static const BuiltinEntry builtin_##name = {#name, &_makeCommand<type>, CommandPlan::policy, true};
+SMASH_BUILTINS(SMASH_BUILTIN_ENTRY)
+SMASH_NATIVE_UTILS(SMASH_NATIVE_UTIL_ENTRY)
+
+// FNV-1a with a seed picked so that no two builtin names share a slot
+#define BUILTIN_SEED 20u
+#define BUILTIN_SLOTS 128u
+
+static constexpr uint32_t _hashName(const char* s, uint32_t h = BUILTIN_SEED) {
+  return *s == '\0' ? h : _hashName(s + 1, (h ^ (unsigned char)*s) * 16777619u);
+}
+
+/**
+* Returns the builtin named firstWord, or nullptr. The slots are case labels, so a collision
+* between two names fails to compile (change BUILTIN_SEED then) and the lookup is one jump
+* through the switch table plus a single strcmp.
+*/
+static const BuiltinEntry* _findBuiltin(const char* firstWord) {
+  const BuiltinEntry* entry = nullptr;
+  switch (_hashName(firstWord) % BUILTIN_SLOTS) {
+#define SMASH_BUILTIN_CASE(name, type, policy) \
+    case _hashName(#name) % BUILTIN_SLOTS: entry = &builtin_##name; break;
+    SMASH_BUILTINS(SMASH_BUILTIN_CASE)
+    SMASH_NATIVE_UTILS(SMASH_BUILTIN_CASE)
+    default: return nullptr;
+  }
+  return strcmp(entry->name, firstWord) == 0 ? entry : nullptr;
+}
+
+/**
+* Moves the redirections of a single command out of line into actions, in the order they are
+* written: [n]<file, [n]>file, [n]>>file, [n]>&m, &>file and &>>file. Their text is blanked
+* rather than erased, so the rest of the line keeps its offsets.
+*/
+static void _parseRedirections(string& line, vector<FdAction>& actions) {
+  size_t i = 0;
+  while (i < line.length()) {
+    size_t start = i;
+    size_t j = i;
+    int fd = -1;
+    bool to_both = false;
+    // A number is an fd only as a word of its own directly followed by the operator
+    if (isdigit((unsigned char)line[j]) && (j == 0 || isspace((unsigned char)line[j - 1]))) {
+      while (j < line.length() && isdigit((unsigned char)line[j])) j++;
+      if (j < line.length() && (line[j] == '<' || line[j] == '>') && j - i < 4) {
+        fd = atoi(line.c_str() + i);
+      }
+      else {
+        j = i;
+      }
+    }
+    if (fd == -1 && line.compare(j, 2, "&>") == 0) {
+      to_both = true;
+      j++;
+    }
+    if (j >= line.length() || (line[j] != '<' && line[j] != '>')) {
+      i = j + 1;
+      continue;
+    }
+    FdAction action = {fd, FdAction::OPEN, "", O_RDONLY};
+    if (line[j] == '<') {
+      if (fd == -1) action.fd = 0;
+      j++;
+    }
+    else {
+      if (fd == -1) action.fd = 1;
+      bool is_append = line.compare(j, 2, ">>") == 0;
+      j += is_append ? 2 : 1;
+      action.flags = O_CREAT | O_RDWR | (is_append ? O_APPEND : O_TRUNC);
+      if (!to_both && j < line.length() && line[j] == '&') {
+        size_t k = j + 1;
+        while (k < line.length() && isdigit((unsigned char)line[k])) k++;
+        if (k > j + 1 && (k == line.length() || isspace((unsigned char)line[k]))) {
+          // >&m makes fd a copy of m
+          action.source = atoi(line.c_str() + j + 1);
+          action.flags = 0;
+          actions.push_back(action);
+          line.replace(start, k - start, k - start, ' ');
+          i = k;
+          continue;
+        }
+        // >&file is &>file
+        to_both = fd == -1;
+        j++;
+      }
+    }
+    while (j < line.length() && isspace((unsigned char)line[j])) j++;
+    size_t path_start = j;
+    while (j < line.length() && !isspace((unsigned char)line[j]) && line[j] != '<' && line[j] != '>') j++;
+    action.path = line.substr(path_start, j - path_start);
+    actions.push_back(action);
+    if (to_both) {
+      actions.push_back({2, 1, "", 0});
+    }
+    line.replace(start, j - start, j - start, ' ');
+    i = j;
+  }
+}
+
+/**
+* Parses cmd_line into a plan: its kind, its tokens and redirections, and for a pipe the plans of
+* its stages. Only the builtins loaded by enable are shell state here, and changing them clears the
+* plan cache, so the result can be reused for the same line.
+*/
+static shared_ptr<const CommandPlan> _parsePlan(const string& cmd_line) {
+  shared_ptr<CommandPlan> plan(new CommandPlan());
+  plan->original_cmd_line = cmd_line;
+  plan->cmd_line = cmd_line;
+  plan->is_background = false;
+  plan->builtin = nullptr;
+  if (_isBackgroundComamnd(plan->cmd_line)) {
+    plan->is_background = true;
+    _removeBackgroundSign(plan->cmd_line);
+    plan->cmd_line = _trim(plan->cmd_line);
+  }
+  string& line = plan->cmd_line;
+
+  size_t i;
+  if (line.find('|') != string::npos) {
+    // Split on every | and |& in one pass, |& feeds the stage's stderr to the next one
+    plan->kind = CommandPlan::PIPE;
+    plan->policy = CommandPlan::RUN_PIPELINE;
+    size_t start = 0;
+    while ((i = line.find('|', start)) != string::npos) {
+      bool to_cerr = i + 1 < line.length() && line[i + 1] == '&';
+      plan->stages.push_back(_parsePlan(line.substr(start, i - start)));
+      plan->stderr_to_pipe.push_back(to_cerr);
+      start = i + (to_cerr ? 2 : 1);
+    }
+    plan->stages.push_back(_parsePlan(line.substr(start)));
+    return plan;
+  }
+  if (line.find_first_of("<>") != string::npos) {
+    _parseRedirections(line, plan->fd_actions);
+    line = _rtrim(line);
+  }
+
+  plan->arena = line;
+  vector<char*> argv;
+  _parseCommandLine(plan->arena, argv);
+  argv.pop_back();
+  for (char* token : argv) {
+    plan->tokens.push_back(token - &plan->arena[0]);
+  }
+  string cmd_s = _trim(line);
+  string first_word = cmd_s.substr(0, cmd_s.find_first_of(" \n"));
+  plan->builtin = _findBuiltin(first_word.c_str());
+  // Wildcards are expanded for external commands only
+  if (plan->builtin != nullptr && plan->builtin->is_native_util &&
+      (!SmallShell::getInstance().useNativeUtils() || line.find_first_of("*?") != string::npos)) {
+    plan->builtin = nullptr;
+  }
+  if (plan->builtin != nullptr) {
+    plan->kind = CommandPlan::BUILTIN;
+    plan->policy = plan->builtin->policy;
+  }
+  else if ((plan->loaded = SmallShell::getInstance().findLoadedBuiltin(first_word)) != nullptr) {
+    plan->kind = CommandPlan::LOADED;
+    plan->policy = plan->loaded->is_unsafe ? CommandPlan::RUN_FORKED : CommandPlan::RUN_IN_PARENT;
+  }
+  else {
+    plan->kind = CommandPlan::EXTERNAL;
+    plan->policy = CommandPlan::RUN_IN_CHILD;
+  }
+  return plan;
+}
+
+Command::Command(const CommandPlan& plan) : original_cmd_line(plan.original_cmd_line),
+  cmd_line(plan.cmd_line), args(), num_of_args(plan.tokens.size()), is_background(plan.is_background),
+  policy(plan.policy), exit_status(0), fd_actions(plan.fd_actions), stdio{0, 1, 2}, arena(plan.arena), argv() {
+  for (size_t offset : plan.tokens) {
+    argv.push_back(&arena[offset]);
+  }
+  argv.push_back(nullptr);
+  args = argv.data();
+}
+
+Command::~Command() {
+}
+
+BuiltInCommand::BuiltInCommand(const CommandPlan& plan) : Command(plan) {
+  is_background = false;
+}
+
+ExternalCommand::ExternalCommand(const CommandPlan& plan) : Command(plan), is_complex(false), has_wildcards(false),
+  exec_path(), patterns(), expanded_args(), expanded_argv() {
+  if (this->cmd_line.find('*') != std::string::npos || this->cmd_line.find('?') != std::string::npos) {
+    has_wildcards = true;
+    // Quoting, variables and the like are left to bash, plain patterns are expanded by smash
+    is_complex = this->cmd_line.find_first_of(SHELL_SYNTAX) != std::string::npos;
+  }
+  if (has_wildcards && !is_complex) {
+    patterns.assign(args, args + num_of_args);
+  }
+}
+
+/**
+* Replaces args with the glob(3) expansion of every token holding a pattern.
+* Like bash without nullglob, a pattern that matches nothing is passed on as is.
+*/
+void ExternalCommand::expandWildcards() {
+  expanded_args.clear();
+  for (const char* pattern : patterns) {
+    if (strpbrk(pattern, "*?[") == nullptr) {
+      expanded_args.push_back(pattern);
+      continue;
+    }
+    glob_t matches;
+    if (glob(pattern, GLOB_NOCHECK, nullptr, &matches) == 0) {
+      expanded_args.insert(expanded_args.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+    } else {
+      expanded_args.push_back(pattern);
+    }
+    globfree(&matches);
+  }
+  expanded_argv.clear();
+  for (string& arg : expanded_args) {
+    expanded_argv.push_back(&arg[0]);
+  }
+  expanded_argv.push_back(nullptr);
+  args = expanded_argv.data();
+  num_of_args = expanded_args.size();
+}
+
+/**
+* The argv execvp falls back to for an executable the kernel refuses with ENOEXEC, a script
+* without a #! line: /bin/sh runs path with the rest of args.
+*/
+static vector<char*> _shellArgs(const string& path, char** args) {
+  vector<char*> sh_args = {(char*)"sh", (char*)path.c_str()};
+  for (int i = 1; args[i] != nullptr; i++) {
+    sh_args.push_back(args[i]);
+  }
+  sh_args.push_back(nullptr);
+  return sh_args;
+}
+
+void ExternalCommand::execute() {
+  if (is_complex){
+    char* ext_cmd[] = {(char*)"bash", (char*)"-c", (char*)cmd_line.c_str(), nullptr};
+    execv("/bin/bash", ext_cmd);
+  }
+  else if (!exec_path.empty()) {
+    execv(exec_path.c_str(), args);
+    if (errno == ENOEXEC) {
+      execv("/bin/sh", _shellArgs(exec_path, args).data());
+    }
+  }
+  else {
+    errno = ENOENT;
+  }
+  // If failed print error message
+  perror("smash error: execvp failed");
+  exit(0);
+}
+
+pid_t ExternalCommand::spawn(const posix_spawn_file_actions_t* actions, const posix_spawnattr_t* attr) {
+  pid_t pid;
+  int err;
+  if (is_complex) {
+    char* ext_cmd[] = {(char*)"bash", (char*)"-c", (char*)cmd_line.c_str(), nullptr};
+    err = posix_spawn(&pid, "/bin/bash", actions, attr, ext_cmd, environ);
+  }
+  else if (!exec_path.empty()) {
+    err = posix_spawn(&pid, exec_path.c_str(), actions, attr, args, environ);
+    if (err == ENOEXEC) {
+      // Unlike execvp, posix_spawn does not hand a file without a #! line to the shell
+      vector<char*> sh_args = _shellArgs(exec_path, args);
+      err = posix_spawn(&pid, "/bin/sh", actions, attr, sh_args.data(), environ);
+    }
+  }
+  else {
+    err = ENOENT;
+  }
+  if (err != 0) {
+    errno = err;
+    perror("smash error: execvp failed");
+    return -1;
+  }
+  return pid;
+}
+
+ChangePrompt::ChangePrompt(const CommandPlan& plan) : BuiltInCommand(plan), title("smash") {
+  if (num_of_args < 2) return;
+  title = args[1];
+}
+
+void ChangePrompt::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  smash.changeTitle(title);
+}
+
+void ShowPidCommand::execute() {
+  cout << "smash pid is " << getpid() << endl;
+}
+
+void GetCurrDirCommand::execute() {
+  char* cwd = getcwd(nullptr, 0);
+  cout << cwd << endl;
+  free(cwd);
+}
+
+void ChangeDirCommand::execute() {
+  if (num_of_args < 2){
+    std::string errormessage = "smash error:> \"";
+    errormessage = errormessage + this->original_cmd_line + "\"";
+    cout << errormessage << endl;
+    return;
+  }
+  if (num_of_args > 2) {
+    cerr << "smash error: cd: too many arguments" << endl;
+    return;
+  }
+
+  char* cwd = getcwd(nullptr, 0);
+  if(cwd == 0){
+    perror("smash error: getcwd failed");
+    return;
+  }
+  SmallShell& smash = SmallShell::getInstance();
+  if (strcmp(args[1], "-") == 0) {
+    string new_wd = smash.getLastWD();
+    if (new_wd.empty()) {
+      free(cwd);
+      cerr << "smash error: cd: OLDPWD not set" << endl;
+      return;
+    }
+    if (chdir(new_wd.c_str()) != 0) {
+      free(cwd);
+      perror("smash error: chdir failed");
+      return;
+    }
+  }
+  else if (chdir(args[1]) != 0) {
+    free(cwd);
+    perror("smash error: chdir failed");
+    return;
+  }
+
+  smash.setLastWD(cwd);
+  free(cwd);
+}
+
+void JobsCommand::execute() {
+  if (num_of_args == 2 && strcmp(args[1], "-l") == 0) {
+    SmallShell::getInstance().job_list.printJobsUsage();
+    return;
+  }
+  SmallShell::getInstance().job_list.printJobsList();
+}
+
+void ForegroundCommand::execute() {
+  if (num_of_args > 2) {
+    cerr << "smash error: fg: invalid arguments" << endl;
+    return;
+  }
+
+  int target_id;
+  JobsList::JobEntry* target_job;
+  SmallShell& smash = SmallShell::getInstance();
+  if (num_of_args == 2) {
+    try {
+      target_id = stoi(args[1]);
+    } catch (...) {
+      cerr << "smash error: fg: invalid arguments" << endl;
+      return;
+    }
+    target_job = smash.job_list.getJobById(target_id);
+    if (target_job == nullptr) {
+      string err = "smash error: fg: job-id " + string(args[1]) + " does not exist";
+      cerr << err.c_str() << endl;
+      return;
+    }
+  } else {
+      target_job = smash.job_list.getLastJob(&target_id);
+      if (target_job == nullptr) {
+        cerr << "smash error: fg: jobs list is empty" << endl;
+        return;
+      }
+  }
+
+  cout << target_job->cmd->original_cmd_line << " : " << target_job->pid << endl;
+
+  // Placement is for background jobs only
+  smash.job_list.releaseJob(target_job);
+  JobsList::JobEntry job = *target_job;
+  smash.job_list.removeJobById(target_id);
+  if(job.sendSignal(SIGCONT) == -1){
+    perror("smash error: kill failed");
+  }
+  smash.waitForeground(job.cmd, job.pids, target_id, &job.usage);
+}
+
+void FareCommand::execute(){
+  // fare <file> <src> <dst> [<src> <dst>]... or fare -f <mapping> <file>..., where any file may be a glob
+  FarePatterns patterns;
+  vector<string> file_args;
+  if (num_of_args >= 4 && strcmp(args[1], "-f") == 0) {
+    if (!ReadMapping(args[2], patterns)) return;
+    file_args.assign(args + 3, args + num_of_args);
+  }
+  else if (num_of_args >= 4 && num_of_args % 2 == 0) {
+    file_args.push_back(args[1]);
+    for (int i = 2; i < num_of_args; i += 2) {
+      patterns.add(args[i], args[i + 1]);
+    }
+  }
+  else {
+    cerr << "smash error: fare: invalid arguments" << endl;
+    return;
+  }
+  patterns.compile();
+
+  vector<FareResult> results;
+  for (const string& file_arg : file_args) {
+    if (strpbrk(file_arg.c_str(), "*?[") == nullptr) {
+      results.push_back({file_arg, {}, false, nullptr, 0});
+      continue;
+    }
+    glob_t matches;
+    if (glob(file_arg.c_str(), GLOB_NOCHECK, nullptr, &matches) == 0) {
+      for (size_t i = 0; i < matches.gl_pathc; i++) {
+        results.push_back({matches.gl_pathv[i], {}, false, nullptr, 0});
+      }
+    } else {
+      results.push_back({file_arg, {}, false, nullptr, 0});
+    }
+    globfree(&matches);
+  }
+
+  // Files are independent, so they are spread over one worker per allowed CPU
+  size_t workers = 1;
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    workers = CPU_COUNT(&cpus);
+  }
+  workers = min(workers, results.size());
+  std::atomic<size_t> next_file(0);
+  auto work = [&]() {
+    size_t i;
+    while ((i = next_file++) < results.size()) {
+      ProcessFile(results[i], patterns);
+    }
+  };
+  vector<std::thread> pool;
+  for (size_t i = 1; i < workers; i++) {
+    pool.emplace_back(work);
+  }
+  work();
+  for (std::thread& worker : pool) {
+    worker.join();
+  }
+
+  vector<size_t> totals(patterns.from.size(), 0);
+  bool is_any_written = false;
+  for (const FareResult& result : results) {
+    if (result.failed_call != nullptr) {
+      errno = result.error;
+      perror(("smash error: " + string(result.failed_call) + " failed").c_str());
+      continue;
+    }
+    if (!result.is_written) continue;
+    is_any_written = true;
+    size_t times = 0;
+    for (size_t i = 0; i < totals.size(); i++) {
+      totals[i] += result.counts[i];
+      times += result.counts[i];
+    }
+    if (results.size() > 1) {
+      cout << result.file_name << ": replaced " << times << " instances" << endl;
+    }
+  }
+  if (is_any_written) {
+    for (size_t i = 0; i < totals.size(); i++) {
+      cout << "replaced " <<  totals[i] << " instances of the string \"" << patterns.from[i] << "\"" << endl;
+    }
+  }
+}
+
+static bool _readAll(int fd, char* data, size_t* length) {
+  size_t total = 0;
+  while (total < *length) {
+    ssize_t bytes_read = read(fd, data + total, *length - total);
+    if (bytes_read == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (bytes_read == 0) break;
+    total += bytes_read;
+  }
+  *length = total;
+  return true;
+}
+
+static bool _fareFailed(FareCommand::FareResult& result, const char* call, int fd = -1) {
+  result.failed_call = call;
+  result.error = errno;
+  if (fd != -1) close(fd);
+  return false;
+}
+
+// Whether the temporary file could not be created because the directory does not let us write to it
+static bool _isTempFileDenied(const FareCommand::FareResult& result) {
+  return result.failed_call != nullptr && strcmp(result.failed_call, "mkstemp") == 0 &&
+         (result.error == EACCES || result.error == EPERM);
+}
+
+/**
+* Rewrites one file for a fare worker and records the outcome in result. Files up to FARE_SMALL_FILE
+* are read with a single read into a per-thread buffer, larger ones are mapped and the largest are
+* streamed. Errors are recorded rather than printed so the caller can report them in order.
+*/
+bool FareCommand::ProcessFile(FareResult& result, const FarePatterns& patterns) {
+  static thread_local vector<char> buffer;
+  int fd = open(result.file_name.c_str(), O_RDWR);
+  if (fd == -1) {
+    return _fareFailed(result, "open");
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    return _fareFailed(result, "fstat", fd);
+  }
+
+  size_t length = st.st_size;
+  if (length > FARE_STREAM_THRESHOLD) {
+    result.is_written = StreamFile(result, fd, st.st_mode, patterns);
+    if (!_isTempFileDenied(result)) {
+      close(fd);
+      return result.is_written;
+    }
+    // The directory takes no temporary file, so the file is mapped and rewritten in place below
+    result.failed_call = nullptr;
+  }
+
+  char* data = nullptr;
+  bool is_mapped = length > FARE_SMALL_FILE;
+  if (is_mapped) {
+    void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      return _fareFailed(result, "mmap", fd);
+    }
+    madvise(mapped, length, MADV_SEQUENTIAL);
+    data = (char*)mapped;
+  }
+  else if (length > 0) {
+    buffer.resize(length);
+    if (!_readAll(fd, buffer.data(), &length)) {
+      return _fareFailed(result, "read", fd);
+    }
+    data = buffer.data();
+  }
+
+  size_t times = CountSubStrings(data, length, patterns, result.counts);
+  result.is_written = times == 0 || RewriteFile(result, fd, st.st_mode, data, length, patterns);
+  if (is_mapped) {
+    munmap(data, length);
+  }
+  close(fd);
+  return result.is_written;
+}
+
+/**
+* Reads src/dst pairs from a mapping file, one "<src> <dst>" pair per line.
+* Empty lines and lines starting with # are skipped.
+*/
+bool FareCommand::ReadMapping(const std::string& file_name, FarePatterns& patterns) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    perror("smash error: open failed");
+    return false;
+  }
+  string content;
+  char buf[4096];
+  ssize_t bytes_read;
+  while ((bytes_read = read(fd, buf, sizeof(buf))) != 0) {
+    if (bytes_read == -1) {
+      if (errno == EINTR) continue;
+      perror("smash error: read failed");
+      close(fd);
+      return false;
+    }
+    content.append(buf, bytes_read);
+  }
+  close(fd);
+
+  size_t start = 0;
+  while (start < content.length()) {
+    size_t end = content.find('\n', start);
+    if (end == string::npos) end = content.length();
+    string line = _trim(content.substr(start, end - start));
+    start = end + 1;
+    if (line.empty() || line[0] == '#') continue;
+    vector<char*> fields;
+    if (_parseCommandLine(line, fields) != 2) {
+      cerr << "smash error: fare: invalid arguments" << endl;
+      return false;
+    }
+    patterns.add(fields[0], fields[1]);
+  }
+  if (patterns.from.empty()) {
+    cerr << "smash error: fare: invalid arguments" << endl;
+    return false;
+  }
+  return true;
+}
+
+// memchr for single bytes, memmem otherwise, both are vectorized in glibc
+static const char* _findSubString(const char* data, size_t length, const std::string& str) {
+  if (str.length() == 1) {
+    return (const char*)memchr(data, str[0], length);
+  }
+  return (const char*)memmem(data, length, str.data(), str.length());
+}
+
+void FarePatterns::add(const std::string& src, const std::string& dst) {
+  from.push_back(src);
+  to.push_back(dst);
+}
+
+/**
+* Builds the automaton for leftmost-longest matching: the trie of every src, completed into a
+* DFA over the byte classes the patterns use. As in leftmost Aho-Corasick, a state that
+* completes a pattern gets the dead state as its failure link, so once a match has started
+* the search only goes on while it can still grow into a longer one from the same start.
+* A src given twice keeps its first dst.
+*/
+void FarePatterns::compile() {
+  if (from.size() == 1) return;
+  vector<bool> is_used(256, false);
+  for (const string& src : from) {
+    for (unsigned char c : src) is_used[c] = true;
+  }
+  // Class 0 stands for every byte no pattern uses
+  stride = 1;
+  for (int c = 0; c < 256; c++) {
+    classes[c] = is_used[c] ? stride++ : 0;
+  }
+
+  delta.assign(2 * stride, -1);
+  out.assign(2, -1);
+  depth.assign(2, 0);
+  std::fill(delta.begin(), delta.begin() + stride, 0);
+  for (size_t i = 0; i < from.size(); i++) {
+    int state = 1;
+    for (unsigned char c : from[i]) {
+      int next = delta[state * stride + classes[c]];
+      if (next == -1) {
+        next = out.size();
+        delta[state * stride + classes[c]] = next;
+        delta.resize(delta.size() + stride, -1);
+        out.push_back(-1);
+        depth.push_back(depth[state] + 1);
+      }
+      state = next;
+    }
+    if (out[state] == -1) out[state] = i;
+  }
+
+  vector<int> fail(out.size(), 0);
+  vector<int> queue;
+  for (int c = 0; c < stride; c++) {
+    int& next = delta[stride + c];
+    if (next == -1) {
+      next = 1;
+      continue;
+    }
+    fail[next] = out[next] == -1 ? 1 : 0;
+    queue.push_back(next);
+  }
+  // Breadth first, so the row of a failure target is complete before it is used
+  for (size_t head = 0; head < queue.size(); head++) {
+    int state = queue[head];
+    for (int c = 0; c < stride; c++) {
+      int& next = delta[state * stride + c];
+      int fallback = delta[fail[state] * stride + c];
+      if (next == -1) {
+        next = fallback;
+        continue;
+      }
+      queue.push_back(next);
+      if (out[next] == -1) {
+        fail[next] = fallback;
+        out[next] = out[fallback];
+      }
+    }
+  }
+}
+
+/**
+* Returns the leftmost-longest match in [data, end) and sets *pattern to its index, or nullptr if
+* there is none. Unless is_final, a match that more input could still extend is not returned and
+* *tail is set to the first byte a match may yet start at; otherwise *tail is end.
+*/
+const char* FarePatterns::find(const char* data, const char* end, bool is_final, int* pattern,
+                               const char** tail) const {
+  *tail = end;
+  if (from.size() == 1) {
+    *pattern = 0;
+    const char* match = _findSubString(data, end - data, from[0]);
+    if (match == nullptr && !is_final) {
+      *tail = end - min((size_t)(end - data), from[0].length() - 1);
+    }
+    return match;
+  }
+  const char* match = nullptr;
+  int state = 1;
+  for (const char* p = data; p < end; p++) {
+    state = delta[state * stride + classes[(unsigned char)*p]];
+    if (state == 0) break;
+    if (out[state] != -1) {
+      *pattern = out[state];
+      match = p + 1 - from[*pattern].length();
+    }
+  }
+  if (state != 0 && !is_final) {
+    *tail = end - depth[state];
+    return nullptr;
+  }
+  return match;
+}
+
+size_t FareCommand::CountSubStrings(const char* data, size_t length, const FarePatterns& patterns,
+                                   vector<size_t>& counts) {
+  counts.assign(patterns.from.size(), 0);
+  size_t counter = 0;
+  const char* end = data + length;
+  const char* match;
+  const char* tail;
+  int pattern;
+  while (data < end && (match = patterns.find(data, end, true, &pattern, &tail)) != nullptr) {
+    counts[pattern]++;
+    counter++;
+    data = match + patterns.from[pattern].length();
+  }
+  return counter;
+}
+
+/**
+* Writes data with every leftmost-longest occurrence of a src replaced by its dst into out, which
+* must hold the exact result size. Returns the end of the written range.
+*/
+char* FareCommand::ReplaceSubStrings(const char* data, size_t length, const FarePatterns& patterns, char* out) {
+  const char* end = data + length;
+  const char* match;
+  const char* tail;
+  int pattern;
+  while (data < end && (match = patterns.find(data, end, true, &pattern, &tail)) != nullptr) {
+    const string& to = patterns.to[pattern];
+    memcpy(out, data, match - data);
+    out += match - data;
+    memcpy(out, to.data(), to.length());
+    out += to.length();
+    data = match + patterns.from[pattern].length();
+  }
+  memcpy(out, data, end - data);
+  return out + (end - data);
+}
+
+int FareCommand::ReplaceSubStrings(std::string& str, const std::string& from, const std::string& to) {
+  FarePatterns patterns;
+  patterns.add(from, to);
+  patterns.compile();
+  vector<size_t> counts;
+  size_t counter = CountSubStrings(str.data(), str.length(), patterns, counts);
+  if (counter == 0) return 0;
+  std::string result(str.length() + counter * to.length() - counter * from.length(), '\0');
+  ReplaceSubStrings(str.data(), str.length(), patterns, &result[0]);
+  str.swap(result);
+  return counter;
+}
+
+// Creates an empty temporary file next to the real target of file_name
+static int _createTempFile(const std::string& file_name, std::string& target, std::string& temp_name) {
+  target = file_name;
+  char* real_path = realpath(file_name.c_str(), nullptr);
+  if (real_path != nullptr) {
+    target = real_path;
+    free(real_path);
+  }
+  temp_name = target + ".XXXXXX";
+  return mkstemp(&temp_name[0]);
+}
+
+// Closes and removes a temporary file that will not be used, keeping errno
+static void _discardTempFile(int out, const std::string& temp_name) {
+  int saved_errno = errno;
+  if (out != -1) close(out);
+  unlink(temp_name.c_str());
+  errno = saved_errno;
+}
+
+/**
+* Closes the temporary file and moves it over target. Returns the call that failed, with errno set,
+* or nullptr once target was replaced.
+*/
+static const char* _commitTempFile(int out, mode_t mode, const std::string& temp_name, const std::string& target) {
+  if (fchmod(out, mode & 07777) == -1) {
+    _discardTempFile(out, temp_name);
+    return "fchmod";
+  }
+  if (close(out) == -1) {
+    _discardTempFile(-1, temp_name);
+    return "close";
+  }
+  if (rename(temp_name.c_str(), target.c_str()) == -1) {
+    _discardTempFile(-1, temp_name);
+    return "rename";
+  }
+  return nullptr;
+}
+
+static bool _writeAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+// A write over the file size limit (ulimit -f) leaves the file as it was without a word, other failures are reported
+static bool _fareWriteFailed(FareCommand::FareResult& result, const char* call) {
+  if (errno == EFBIG) return false;
+  return _fareFailed(result, call);
+}
+
+/**
+* Builds the replaced content in a temporary file next to file_name, then renames it over the original.
+* Results up to FARE_SMALL_FILE are built in memory and written at once, larger ones are sized up
+* front and filled through a shared mapping. In a directory that takes no temporary file, the
+* content is built in memory and written over the file through fd instead, which is not atomic.
+*/
+bool FareCommand::RewriteFile(FareResult& result, int fd, mode_t mode, const char* data, size_t length,
+                              const FarePatterns& patterns) {
+  const vector<size_t>& counts = result.counts;
+  size_t out_length = length;
+  for (size_t i = 0; i < counts.size(); i++) {
+    out_length = out_length + counts[i] * patterns.to[i].length() - counts[i] * patterns.from[i].length();
+  }
+
+  string target, temp_name;
+  int out = _createTempFile(result.file_name, target, temp_name);
+  if (out == -1 && (errno == EACCES || errno == EPERM)) {
+    vector<char> content(out_length);
+    ReplaceSubStrings(data, length, patterns, content.data());
+    // Growing the file first fails over the size limit before anything was overwritten
+    if (out_length > length && ftruncate(fd, out_length) == -1) {
+      return _fareWriteFailed(result, "ftruncate");
+    }
+    if (lseek(fd, 0, SEEK_SET) == -1) {
+      return _fareFailed(result, "lseek");
+    }
+    if (!_writeAll(fd, content.data(), out_length)) {
+      return _fareWriteFailed(result, "write");
+    }
+    if (out_length < length && ftruncate(fd, out_length) == -1) {
+      return _fareFailed(result, "ftruncate");
+    }
+    return true;
+  }
+  if (out == -1) {
+    return _fareFailed(result, "mkstemp");
+  }
+
+  if (out_length <= FARE_SMALL_FILE) {
+    static thread_local vector<char> buffer;
+    buffer.resize(out_length);
+    ReplaceSubStrings(data, length, patterns, buffer.data());
+    if (!_writeAll(out, buffer.data(), out_length)) {
+      _discardTempFile(out, temp_name);
+      return _fareWriteFailed(result, "write");
+    }
+  }
+  else {
+    int error = posix_fallocate(out, 0, out_length);
+    if (error != 0) {
+      _discardTempFile(out, temp_name);
+      errno = error;
+      return _fareWriteFailed(result, "posix_fallocate");
+    }
+    void* mapped = mmap(nullptr, out_length, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    if (mapped == MAP_FAILED) {
+      _discardTempFile(out, temp_name);
+      return _fareFailed(result, "mmap");
+    }
+    ReplaceSubStrings(data, length, patterns, (char*)mapped);
+    if (munmap(mapped, out_length) == -1) {
+      _discardTempFile(out, temp_name);
+      return _fareFailed(result, "munmap");
+    }
+  }
+  const char* failed_call = _commitTempFile(out, mode, temp_name, target);
+  return failed_call == nullptr || _fareFailed(result, failed_call);
+}
+
+/**
+* Replaces every src with its dst reading fd in FARE_CHUNK_SIZE blocks, so memory stays bounded
+* whatever the file size. The bytes of a block from where a match may still start (at most the
+* longest src) are carried into the next block. Output goes to a temporary file that is renamed
+* over file_name, unless nothing matched.
+*/
+bool FareCommand::StreamFile(FareResult& result, int fd, mode_t mode, const FarePatterns& patterns) {
+  vector<size_t>& counts = result.counts;
+  counts.assign(patterns.from.size(), 0);
+  string target, temp_name;
+  int out = _createTempFile(result.file_name, target, temp_name);
+  if (out == -1) {
+    return _fareFailed(result, "mkstemp");
+  }
+
+  size_t max_length = 0;
+  for (const string& src : patterns.from) {
+    max_length = max(max_length, src.length());
+  }
+  vector<char> in_buf(FARE_CHUNK_SIZE + max_length);
+  vector<char> out_buf;
+  out_buf.reserve(FARE_CHUNK_SIZE + max_length);
+  size_t carry = 0;
+  size_t times = 0;
+  const char* failed_call = nullptr;
+  while (failed_call == nullptr) {
+    ssize_t bytes_read = read(fd, in_buf.data() + carry, FARE_CHUNK_SIZE);
+    if (bytes_read == -1) {
+      if (errno == EINTR) continue;
+      failed_call = "read";
+      break;
+    }
+    bool is_eof = bytes_read == 0;
+    const char* data = in_buf.data();
+    const char* end = data + carry + bytes_read;
+    const char* tail = end;
+    const char* match;
+    int pattern;
+    while (failed_call == nullptr && data < end &&
+           (match = patterns.find(data, end, is_eof, &pattern, &tail)) != nullptr) {
+      const string& to = patterns.to[pattern];
+      out_buf.insert(out_buf.end(), data, match);
+      out_buf.insert(out_buf.end(), to.begin(), to.end());
+      data = match + patterns.from[pattern].length();
+      counts[pattern]++;
+      times++;
+      if (out_buf.size() >= FARE_CHUNK_SIZE) {
+        if (!_writeAll(out, out_buf.data(), out_buf.size())) failed_call = "write";
+        out_buf.clear();
+      }
+    }
+    if (failed_call != nullptr) break;
+    carry = end - max(data, tail);
+    out_buf.insert(out_buf.end(), data, end - carry);
+    if (!_writeAll(out, out_buf.data(), out_buf.size())) failed_call = "write";
+    out_buf.clear();
+    memmove(in_buf.data(), end - carry, carry);
+    if (is_eof) break;
+  }
+
+  if (failed_call != nullptr) {
+    _discardTempFile(out, temp_name);
+    return strcmp(failed_call, "write") == 0 ? _fareWriteFailed(result, failed_call) : _fareFailed(result, failed_call);
+  }
+  if (times == 0) {
+    // Nothing to replace, keep the original file as is
+    _discardTempFile(out, temp_name);
+    return true;
+  }
+  failed_call = _commitTempFile(out, mode, temp_name, target);
+  return failed_call == nullptr || _fareFailed(result, failed_call);
+}
+
+void KillCommand::execute() {
+  if (num_of_args != 3){
+    cerr << "smash error: kill: invalid arguments" << endl;
+    return;
+  }
+  int signum;
+  int job_id;
+  try {
+    signum = -1 * stoi(args[1]);
+    job_id = stoi(args[2]);
+  } catch (...) {
+    cerr << "smash error: kill: invalid arguments" << endl;
+    return;
+  }
+  if (!(signum >= 1 && signum <= 31)) {
+    cerr << "smash error: kill: invalid arguments" << endl;
+    return;
+  }
+  JobsList::JobEntry* job = jobs_list->getJobById(job_id);
+  if (job == nullptr) {
+    cerr << "smash error: kill: job-id " << job_id << " does not exist" << endl;
+    return;
+  }
+  int pid = job->pid;
+  switch (signum) {
+    case SIGCONT:
+      if (job->sendSignal(SIGCONT) == -1) {
+        perror("smash error: kill failed");
+        return;
+      }
+      jobs_list->setStopped(job, false);
+      break;
+    case SIGSTOP:
+      if (job->sendSignal(SIGSTOP) == -1) {
+        perror("smash error: kill failed");
+        return;
+      }
+      jobs_list->setStopped(job, true);
+      break;
+    case SIGKILL:
+      if (job->sendSignal(SIGKILL) == -1) {
+        perror("smash error: kill failed");
+        return;
+      }
+      break;
+    case SIGTERM:
+      if (job->sendSignal(SIGTERM) == -1) {
+        perror("smash error: kill failed");
+        return;
+      }
+      break;
+    default:
+      if (job->sendSignal(signum) == -1) {
+        perror("smash error: kill failed");
+        return;
+      }
+  }
+  cout << "signal number " << signum << " was sent to pid " << pid << endl;
+}
+
+void BackgroundCommand::execute() {
+  if (num_of_args > 2) {
+    cerr << "smash error: bg: invalid arguments" << endl;
+    return;
+  }
+
+  int target_id;
+  JobsList::JobEntry* target_job;
+  SmallShell& smash = SmallShell::getInstance();
+  if (num_of_args == 2) {
+    try {
+      target_id = stoi(args[1]);
+    } catch (...) {
+      cerr << "smash error: bg: invalid arguments" << endl;
+      return;
+    }
+    target_job = smash.job_list.getJobById(target_id);
+    if (target_job == nullptr) {
+      string err = "smash error: bg: job-id " + string(args[1]) + " does not exist";
+      cerr << err.c_str() << endl;
+      return;
+    }
+    else if (target_job->is_stopped == 0) {
+      string err = "smash error: bg: job-id " + string(args[1]) + " is already running in the background";
+      cerr << err.c_str() << endl;
+      return;
+    }
+  } else {
+      target_job = smash.job_list.getLastStoppedJob(&target_id);
+      if (target_job == nullptr) {
+        cerr << "smash error: bg: there is no stopped jobs to resume" << endl;
+        return;
+      }
+  }
+
+  cout << target_job->cmd->original_cmd_line << " : " << target_job->pid << endl;
+  smash.job_list.setStopped(target_job, false);
+  if (smash.job_list.auto_place && target_job->core < 0) {
+    smash.job_list.placeJob(target_job);
+  }
+  if(target_job->sendSignal(SIGCONT) == -1){
+    perror("smash error: kill failed");
+  }
+}
+
+void QuitCommand::execute() {
+  bool is_kill = false;
+  for (int i = 1; i < num_of_args; i++) {
+    if (strcmp("kill", args[i]) == 0) {
+      is_kill = true;
+    }
+  }
+  if (is_kill) {
+    SmallShell::getInstance().job_list.killAllJobs();
+    SmallShell::getInstance().job_list.removeFinishedJobs();
+  } 
+  SmallShell::flushOutput();
+  exit(0);
+}
+
+PipeCommand::PipeCommand(const CommandPlan& plan) : Command(plan), stages(), stderr_to_pipe(plan.stderr_to_pipe) {
+  SmallShell& smash = SmallShell::getInstance();
+  for (const auto& stage : plan.stages) {
+    stages.push_back(smash.CreateCommand(*stage));
+  }
+}
+
+// The largest pipe an unprivileged process may ask for
+static int _pipeMaxSize() {
+  int size = 1024 * 1024;
+  FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+  if (file != nullptr) {
+    if (fscanf(file, "%d", &size) != 1) size = 1024 * 1024;
+    fclose(file);
+  }
+  return size;
+}
+
+// Parses a pipe size, a byte count or "max", capped at the largest allowed; -1 when it is neither
+static int _parsePipeSize(const char* value) {
+  if (strcmp(value, "max") == 0) return _pipeMaxSize();
+  char* end;
+  errno = 0;
+  long size = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || size < 0 || errno == ERANGE) return -1;
+  return (int)min(size, (long)_pipeMaxSize());
+}
+
+/**
+* Creates a pipe of size bytes, or of the kernel default for 0. Failing to resize it is not an error,
+* the kernel refuses sizes over the per-user limit and the pipe still works at its default size.
+*/
+static int _makePipe(int fds[2], int size) {
+  if (pipe(fds) != 0) return -1;
+  if (size > 0) fcntl(fds[1], F_SETPIPE_SZ, size);
+  return 0;
+}
+
+/**
+* Starts every stage, wired stdout (or stderr for |&) to the next stage's stdin, all in
+* the process group of the first stage. Returns the pids of the stages that started.
+*/
+vector<pid_t> PipeCommand::launch() {
+  SmallShell& smash = SmallShell::getInstance();
+  vector<pid_t> pids;
+  pid_t pgid = 0;
+  int prev_read = -1;
+  for (size_t i = 0; i < stages.size(); i++) {
+    int new_pipe[2] = {-1, -1};
+    if (i + 1 < stages.size() && _makePipe(new_pipe, smash.pipeSize()) != 0) {
+      cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
+      break;
+    }
+    vector<FdAction> actions;
+    if (prev_read != -1) {
+      actions.push_back({0, prev_read});
+      actions.push_back({prev_read, -1});
+    }
+    if (new_pipe[1] != -1) {
+      actions.push_back({stderr_to_pipe[i] ? 2 : 1, new_pipe[1]});
+      actions.push_back({new_pipe[0], -1});
+      actions.push_back({new_pipe[1], -1});
+    }
+    pid_t pid = smash.launchCommand(stages[i].get(), actions, pgid);
+    if (prev_read != -1) close(prev_read);
+    if (new_pipe[1] != -1) close(new_pipe[1]);
+    prev_read = new_pipe[0];
+    if (pid == -1) continue;
+    if (pgid == 0) pgid = pid;
+    pids.push_back(pid);
+  }
+  if (prev_read != -1) close(prev_read);
+  return pids;
+}
+
+void PipeCommand::execute(){
+  for (pid_t pid : launch()) {
+    waitpid(pid, nullptr, 0);
+  }
+}
+
+// Reads a small file such as one under /proc or /sys, false when it cannot be read
+static bool _readSmallFile(const string& path, string& content) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return false;
+  content.clear();
+  char buf[4096];
+  bool is_ok = true;
+  while (is_ok) {
+    size_t length = sizeof(buf);
+    is_ok = _readAll(fd, buf, &length);
+    content.append(buf, is_ok ? length : 0);
+    if (length < sizeof(buf)) break;
+  }
+  close(fd);
+  return is_ok;
+}
+
+/**
+* Parses a list of cores such as 0-3,8 into cores. Returns false when it is malformed, and clears
+* in_range when it names a core the machine does not have.
+*/
+static bool _parseCpuList(const string& list, cpu_set_t* cores, bool* in_range) {
+  CPU_ZERO(cores);
+  *in_range = true;
+  long count = std::min(get_nprocs_conf(), CPU_SETSIZE);
+  const char* p = list.c_str();
+  while (true) {
+    if (!isdigit((unsigned char)*p)) return false;
+    char* end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (*end == '-') {
+      p = end + 1;
+      if (!isdigit((unsigned char)*p)) return false;
+      last = strtol(p, &end, 10);
+    }
+    if (last < first) return false;
+    for (long core = first; core <= last && core < count; core++) {
+      CPU_SET(core, cores);
+    }
+    if (last >= count) *in_range = false;
+    if (*end == '\0') return true;
+    if (*end != ',') return false;
+    p = end + 1;
+  }
+}
+
+static bool _isNumber(const char* s) {
+  return *s != '\0' && strspn(s, "0123456789") == strlen(s);
+}
+
+// Processes of process group pgid, found by their stat in /proc
+static vector<pid_t> _groupProcesses(pid_t pgid) {
+  vector<pid_t> pids;
+  DIR* proc = opendir("/proc");
+  if (proc == nullptr) return pids;
+  while (struct dirent* entry = readdir(proc)) {
+    if (!_isNumber(entry->d_name)) continue;
+    string stat;
+    if (!_readSmallFile(string("/proc/") + entry->d_name + "/stat", stat)) continue;
+    // The command name may hold anything, the fields after it are state, ppid and pgrp
+    size_t name_end = stat.rfind(')');
+    int pgrp;
+    if (name_end != string::npos && sscanf(stat.c_str() + name_end + 1, " %*c %*d %d", &pgrp) == 1 && pgrp == pgid) {
+      pids.push_back(atoi(entry->d_name));
+    }
+  }
+  closedir(proc);
+  return pids;
+}
+
+static vector<pid_t> _processThreads(pid_t pid) {
+  vector<pid_t> tids;
+  DIR* task = opendir(("/proc/" + to_string(pid) + "/task").c_str());
+  if (task == nullptr) return tids;
+  while (struct dirent* entry = readdir(task)) {
+    if (_isNumber(entry->d_name)) tids.push_back(atoi(entry->d_name));
+  }
+  closedir(task);
+  return tids;
+}
+
+/**
+* Pins every thread of every process in the job's process group to cores. Threads started while
+* this runs are caught by scanning again until a scan finds nothing new.
+*/
+static void _setJobAffinity(const JobsList::JobEntry& job, const cpu_set_t& cores) {
+  std::set<pid_t> done;
+  bool failed = false;
+  for (int pass = 0; pass < 8; pass++) {
+    vector<pid_t> pids = _groupProcesses(job.pid);
+    if (pids.empty()) pids = job.pids;
+    bool found_new = false;
+    for (pid_t pid : pids) {
+      for (pid_t tid : _processThreads(pid)) {
+        if (!done.insert(tid).second) continue;
+        found_new = true;
+        // A thread may exit between the scan and the call
+        if (sched_setaffinity(tid, sizeof(cpu_set_t), &cores) == -1 && errno != ESRCH && !failed) {
+          perror("smash error: sched_setaffinity failed");
+          failed = true;
+        }
+      }
+    }
+    if (!found_new) break;
+  }
+}
+
+// Moves the pages of the job's processes to node
+static void _migrateJobMemory(const JobsList::JobEntry& job, int node) {
+  const unsigned long all_nodes = ~0UL;
+  const unsigned long target = 1UL << node;
+  vector<pid_t> pids = _groupProcesses(job.pid);
+  if (pids.empty()) pids = job.pids;
+  for (pid_t pid : pids) {
+    if (syscall(SYS_migrate_pages, pid, sizeof(unsigned long) * 8 + 1, &all_nodes, &target) == -1 && errno != ESRCH) {
+      perror("smash error: migrate_pages failed");
+      return;
+    }
+  }
+}
+
+void SetcoreCommand::execute(){
+  // setcore <job-id> <cores>, where cores is a list such as 0-3,8, or setcore <job-id> --node <node> [--mem]
+  bool by_node = num_of_args >= 4 && strcmp(args[2], "--node") == 0;
+  bool move_memory = num_of_args == 5 && strcmp(args[4], "--mem") == 0;
+  if (!(num_of_args == 3 || (by_node && (num_of_args == 4 || move_memory)))) {
+    cerr << "smash error: setcore: invalid arguments" << endl;
+    return;
+  }
+  int job_id;
+  int node = 0;
+  string core_list = args[2];
+  try {
+    job_id = stoi(args[1]);
+    if (by_node) node = stoi(args[3]);
+  } catch (...) {
+    cerr << "smash error: setcore: invalid arguments" << endl;
+    return;
+  }
+  JobsList::JobEntry* job = SmallShell::getInstance().job_list.getJobById(job_id);
+  if(job == nullptr) {
+    cerr << "smash error: setcore: job-id " << job_id << " does not exist" << endl;
+    return;
+  }
+  if (by_node) {
+    // migrate_pages takes the nodes as a single word here
+    bool is_node = node >= 0 && node < int(sizeof(unsigned long) * 8) &&
+                   _readSmallFile("/sys/devices/system/node/node" + to_string(node) + "/cpulist", core_list);
+    core_list = _trim(core_list);
+    if (!is_node || core_list.empty()) {
+      cerr << "smash error: setcore: invalid node number" << endl;
+      return;
+    }
+  }
+  cpu_set_t cores;
+  bool in_range;
+  if (!_parseCpuList(core_list, &cores, &in_range)) {
+    cerr << "smash error: setcore: invalid arguments" << endl;
+    return;
+  }
+  if (!in_range) {
+    cerr << "smash error: setcore: invalid core number" << endl;
+    return;
+  }
+  _setJobAffinity(*job, cores);
+  if (move_memory) {
+    _migrateJobMemory(*job, node);
+  }
+}
+
+void TimeoutCommand::timed_execute(shared_ptr<Command> cmd_ptr) {
+  if (num_of_args <= 2) {
+    // cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
+    cerr << "smash error: " << "timeout: "<< "invalid arguments" << endl;
+    return;
+  }
+  // Fractions of a second are allowed, down to a millisecond
+  char* end;
+  double secs = strtod(args[1], &end);
+  long long timeout_ms = llround(secs * 1000);
+  if (*end != '\0' || !(secs > 0 && secs <= INT_MAX) || timeout_ms < 1) {
+    // cout << "smash error:> \"" + this->original_cmd_line << "\"" << endl;
+    cerr << "smash error: " << "timeout: "<< "invalid arguments" << endl;
+    return;
+  }
+  SmallShell& smash = SmallShell::getInstance();
+
+  auto sec_pos = this->cmd_line.find(args[1]);
+  std::shared_ptr<Command> internal_cmd = smash.CreateCommand(
+    this->original_cmd_line.substr(sec_pos + string(args[1]).length() , string::npos).c_str());
+  
+  // Execution
+  pid_t pid = smash.launchCommand(internal_cmd.get(), {});
+  if(pid == -1){
+    return;
+  }
+  else{
+    shared_ptr<JobsList::JobEntry> timed_job(new JobsList::JobEntry(0, cmd_ptr, pid));
+    smash.timed_jobs.addTimedJob(timeout_ms, timed_job);
+
+    if (internal_cmd->is_background) {
+      smash.job_list.removeFinishedJobs();
+      JobsList::JobEntry* job = smash.job_list.addJob(cmd_ptr, pid, false);
+      if (smash.job_list.auto_place) smash.job_list.placeJob(job);
+    }
+    else{
+      smash.waitForeground(cmd_ptr, {pid}, 0);
+    }
+  }
+}
+
+static long long _monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long _timevalUs(const struct timeval& tv) {
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static string _formatUsage(const JobsList::JobEntry::Usage& usage, long long end_ns) {
+  ostringstream line;
+  line << fixed << setprecision(3) << "real " << (end_ns - usage.start_ns) / 1e9 << "s user "
+       << usage.user_us / 1e6 << "s sys " << usage.sys_us / 1e6 << "s maxrss " << usage.max_rss_kb << "KB";
+  return line.str();
+}
+
+static string _formatStatus(int status) {
+  if (status == -1) return "status unknown";
+  if (WIFSTOPPED(status)) return "stopped";
+  if (WIFSIGNALED(status)) return "signal " + to_string(WTERMSIG(status));
+  return "exit " + to_string(WEXITSTATUS(status));
+}
+
+void TimeCommand::execute() {
+  // time <command>: runs the command in the foreground, then reports on stderr what it took
+  size_t start = original_cmd_line.find_first_not_of(WHITESPACE);
+  start = original_cmd_line.find_first_of(WHITESPACE, start);
+  string inner = start == string::npos ? "" : _trim(original_cmd_line.substr(start));
+  if (num_of_args < 2 || inner.empty()) {
+    cerr << "smash error: time: invalid arguments" << endl;
+    return;
+  }
+  SmallShell& smash = SmallShell::getInstance();
+  shared_ptr<Command> internal_cmd = smash.CreateCommand(inner.c_str());
+  if (internal_cmd == nullptr) return;
+  internal_cmd->is_background = false;
+
+  JobsList::JobEntry::Usage usage;
+  struct rusage self_before, self_after;
+  getrusage(RUSAGE_SELF, &self_before);
+  smash.fg_usage = JobsList::JobEntry::Usage();
+  smash.executeCommand(internal_cmd);
+  getrusage(RUSAGE_SELF, &self_after);
+  long long end_ns = _monotonicNs();
+
+  // A builtin run in smash leaves no foreground job behind, only smash's own usage
+  if (smash.fg_usage.last_pid != -1) {
+    long long start_ns = usage.start_ns;
+    usage = smash.fg_usage;
+    usage.start_ns = start_ns;
+  } else {
+    usage.status = W_EXITCODE(internal_cmd->exit_status, 0);
+    usage.max_rss_kb = self_after.ru_maxrss;
+  }
+  usage.user_us += _timevalUs(self_after.ru_utime) - _timevalUs(self_before.ru_utime);
+  usage.sys_us += _timevalUs(self_after.ru_stime) - _timevalUs(self_before.ru_stime);
+  cerr << _formatUsage(usage, end_ns) << " " << _formatStatus(usage.status) << endl;
+}
+
+TimedJobsList::TimedJobsList() : wheel(), occupied(), slot_min(), pid_index(), current(0), origin(),
+  timer(), has_timer(false) {
+  clock_gettime(CLOCK_MONOTONIC, &origin);
+}
+
+TimedJobsList::~TimedJobsList() {
+  if (has_timer) {
+    timer_delete(timer);
+  }
+}
+
+long long TimedJobsList::now() const {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec - origin.tv_sec) * 1000LL + (ts.tv_nsec - origin.tv_nsec) / 1000000;
+}
+
+/**
+* Moves the entry at it into the slot of the lowest level whose range, as seen from current, holds
+* its expiry: the level of the highest 6-bit group where expiry and current differ. Entries that
+* are already due go to expired.
+*/
+void TimedJobsList::place(std::list<TimedEntry>& from, std::list<TimedEntry>::iterator it,
+                          std::list<TimedEntry>& expired) {
+  if (it->expiry <= current) {
+    expired.splice(expired.end(), from, it);
+    return;
+  }
+  int level = 0;
+  for (unsigned long long diff = it->expiry ^ current; diff >= SLOTS; diff >>= 6) {
+    level++;
+  }
+  int slot = (it->expiry >> (6 * level)) & (SLOTS - 1);
+  if (!(occupied[level] & (1ULL << slot))) {
+    occupied[level] |= 1ULL << slot;
+    slot_min[level][slot] = it->expiry;
+  }
+  slot_min[level][slot] = min(slot_min[level][slot], it->expiry);
+  wheel[level][slot].splice(wheel[level][slot].end(), from, it);
+}
+
+/**
+* Advances current to the given time, stopping at the start of every occupied slot on the way.
+* A level 0 slot reached is due; a higher one is cascaded into the levels below.
+*/
+void TimedJobsList::advance(long long to, std::list<TimedEntry>& expired) {
+  while (true) {
+    long long next = -1;
+    for (int level = 0; level < LEVELS; level++) {
+      int index = (current >> (6 * level)) & (SLOTS - 1);
+      unsigned long long ahead = index == SLOTS - 1 ? 0 : occupied[level] & (~0ULL << (index + 1));
+      if (ahead == 0) continue;
+      long long start = (current & ~((1LL << (6 * (level + 1))) - 1)) + ((long long)__builtin_ctzll(ahead) << (6 * level));
+      next = next == -1 ? start : min(next, start);
+    }
+    if (next == -1 || next > to) break;
+    current = next;
+    for (int level = LEVELS - 1; level >= 0; level--) {
+      int index = (current >> (6 * level)) & (SLOTS - 1);
+      if (!(occupied[level] & (1ULL << index))) continue;
+      occupied[level] &= ~(1ULL << index);
+      std::list<TimedEntry> slot;
+      slot.splice(slot.end(), wheel[level][index]);
+      while (!slot.empty()) {
+        place(slot, slot.begin(), expired);
+      }
+    }
+  }
+  current = max(current, to);
+}
+
+// Earliest expiry in the wheel, -1 if it is empty. Only the first occupied slot ahead on each level can hold it.
+long long TimedJobsList::nextExpiry() const {
+  long long next = -1;
+  for (int level = 0; level < LEVELS; level++) {
+    int index = (current >> (6 * level)) & (SLOTS - 1);
+    unsigned long long ahead = index == SLOTS - 1 ? 0 : occupied[level] & (~0ULL << (index + 1));
+    if (ahead == 0) continue;
+    long long expiry = slot_min[level][__builtin_ctzll(ahead)];
+    next = next == -1 ? expiry : min(next, expiry);
+  }
+  return next;
+}
+
+void TimedJobsList::rearm() {
+  if (!has_timer) {
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) == -1) {
+      perror("smash error: timer_create failed");
+      return;
+    }
+    has_timer = true;
+  }
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  long long next = nextExpiry();
+  if (next != -1) {
+    // An absolute deadline, so a late rearm fires at once instead of drifting
+    long long nsec = origin.tv_nsec + (next % 1000) * 1000000;
+    spec.it_value.tv_sec = origin.tv_sec + next / 1000 + nsec / 1000000000;
+    spec.it_value.tv_nsec = nsec % 1000000000;
+  }
+  if (timer_settime(timer, TIMER_ABSTIME, &spec, nullptr) == -1) {
+    perror("smash error: timer_settime failed");
+  }
+}
+
+void TimedJobsList::addTimedJob(long long timeout_ms, shared_ptr<JobsList::JobEntry> job) {
+  // The wheel is also walked by the SIGALRM handler
+  sigset_t alarm_set, old_set;
+  sigemptyset(&alarm_set);
+  sigaddset(&alarm_set, SIGALRM);
+  sigprocmask(SIG_BLOCK, &alarm_set, &old_set);
+
+  // current may lag behind now, the wheel stays valid as long as the new expiry is past it.
+  // Expiries stay below 64^LEVELS ms from origin so the top level never wraps.
+  long long expiry = min(now() + timeout_ms, (1LL << (6 * LEVELS)) - 1);
+  std::list<TimedEntry> entry(1, TimedEntry{expiry, job});
+  auto it = entry.begin();
+  place(entry, it, entry);
+  pid_index[job->pid] = it;
+  rearm();
+
+  sigprocmask(SIG_SETMASK, &old_set, nullptr);
+}
+
+/**
+* Drops the job of a timed entry once it has exited, but leaves the entry in its slot on purpose:
+* smash reports "got an alarm" at every timeout deadline, including those of commands that already
+* finished (see test_2020_timeout), so the timer must still fire then. The entry goes when it expires.
+*/
+void TimedJobsList::cancelTimedJob(pid_t pid) {
+  sigset_t alarm_set, old_set;
+  sigemptyset(&alarm_set);
+  sigaddset(&alarm_set, SIGALRM);
+  sigprocmask(SIG_BLOCK, &alarm_set, &old_set);
+  auto it = pid_index.find(pid);
+  if (it != pid_index.end()) {
+    it->second->job.reset();
+    pid_index.erase(it);
+  }
+  sigprocmask(SIG_SETMASK, &old_set, nullptr);
+}
+
+void TimedJobsList::handleAlarm() {
+  // Sweep everything due, so a late or coalesced SIGALRM still catches up
+  std::list<TimedEntry> expired;
+  advance(now(), expired);
+  for (TimedEntry& entry : expired) {
+    if (!entry.job) continue;
+    pid_index.erase(entry.job->pid);
+    // Peek without reaping, the SIGCHLD drain owns collecting the status
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PID, entry.job->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == 0) {
+      Trace::instant("timeout", entry.job->pid);
+      Stats::timeouts_fired.fetch_add(1, std::memory_order_relaxed);
+      if (kill(entry.job->pid, SIGKILL) == -1) {
+        perror("smash error: kill failed");
+      }
+      cout << "smash: " << entry.job->cmd->original_cmd_line << " timed out!" << endl;
+    }
+  }
+  rearm();
+}
+
+int JobsList::JobEntry::sendSignal(int sig_num) const {
+  // Every job leads its own process group, so this reaches all stages of a pipeline
+  if (pid <= 1) {
+    errno = ESRCH;
+    return -1;
+  }
+  // The job may print as soon as it gets the signal, so what smash printed before goes out first
+  SmallShell::flushOutput();
+  Stats::signals_forwarded.fetch_add(1, std::memory_order_relaxed);
+  return kill(-pid, sig_num);
+}
+
+JobsList::JobEntry::Usage::Usage(pid_t last_pid) : start_ns(_monotonicNs()), end_ns(0), user_us(0), sys_us(0),
+  max_rss_kb(0), status(-1), last_pid(last_pid) {}
+
+void JobsList::JobEntry::Usage::add(pid_t pid, int status, const struct rusage& usage) {
+  user_us += _timevalUs(usage.ru_utime);
+  sys_us += _timevalUs(usage.ru_stime);
+  max_rss_kb = std::max(max_rss_kb, usage.ru_maxrss);
+  if (pid == last_pid) {
+    this->status = status;
+  }
+}
+
+JobsList::JobEntry* JobsList::addJob(std::shared_ptr<Command> cmd, const std::vector<pid_t>& pids, bool isStopped,
+                                     int job_id, const JobEntry::Usage* usage) {
+  int next_id = job_ids.empty() ? 1 : *job_ids.rbegin() + 1;
+  next_id = job_id == 0 ? next_id : job_id;
+  jobs.erase(next_id);
+  auto it = jobs.insert({next_id, JobEntry(next_id, cmd, pids, isStopped)}).first;
+  if (usage != nullptr) {
+    it->second.usage = *usage;
+  }
+  job_ids.insert(next_id);
+  for (pid_t pid : pids) {
+    pid_index[pid] = next_id;
+  }
+  if (isStopped) {
+    stopped_ids.insert(next_id);
+  } else {
+    stopped_ids.erase(next_id);
+  }
+  return &it->second;
+}
+
+void JobsList::setStopped(JobEntry* job, bool is_stopped) {
+  job->is_stopped = is_stopped;
+  if (is_stopped) {
+    stopped_ids.insert(job->job_id);
+  } else {
+    stopped_ids.erase(job->job_id);
+  }
+}
+
+void JobsList::printJobsList() {
+  time_t now = time(0);
+  for (int id : job_ids) {
+    const JobEntry& job = jobs.at(id);
+    string job_print = "[" + to_string(job.job_id) + "] ";
+    job_print += job.cmd->original_cmd_line + " : ";
+    job_print += to_string(job.pid) + " ";
+    string stime = to_string(int(difftime(now, job.time_started)));
+    job_print +=  stime + " secs";
+    if (job.is_stopped)
+      job_print += " (stopped)";
+    if (job.core >= 0)
+      job_print += " (core " + to_string(job.core) + ")";
+    cout << job_print << endl;
+  }
+}
+
+/**
+* Prints every job with its wall time, then the finished ones with what their processes used.
+*/
+void JobsList::printJobsUsage() {
+  long long now_ns = _monotonicNs();
+  for (int id : job_ids) {
+    const JobEntry& job = jobs.at(id);
+    cout << "[" << job.job_id << "] " << job.cmd->original_cmd_line << " : " << job.pid
+         << (job.is_stopped ? " stopped" : " running") << fixed << setprecision(3)
+         << " real " << (now_ns - job.usage.start_ns) / 1e9 << "s"
+         << (job.core >= 0 ? " core " + to_string(job.core) : "") << endl;
+  }
+  cout << setprecision(6);
+  cout.unsetf(ios::floatfield);
+  for (const JobEntry& job : finished) {
+    cout << "[" << (job.job_id == 0 ? "-" : to_string(job.job_id)) << "] " << job.cmd->original_cmd_line
+         << " : " << job.pid << " " << _formatStatus(job.usage.status) << " "
+         << _formatUsage(job.usage, job.usage.end_ns) << endl;
+  }
+}
+
+/**
+* Keeps job in the history, ordered by when it ended rather than by when smash got to reap it.
+* end_ns is the time the SIGCHLD handler saw it exit, 0 when unknown.
+*/
+void JobsList::addFinished(const JobEntry& job, long long end_ns) {
+  Stats::jobs_reaped.fetch_add(1, std::memory_order_relaxed);
+  auto it = finished.insert(finished.end(), job);
+  it->usage.end_ns = end_ns == 0 ? _monotonicNs() : end_ns;
+  while (it != finished.begin() && (it - 1)->usage.end_ns > it->usage.end_ns) {
+    std::iter_swap(it - 1, it);
+    --it;
+  }
+  if (finished.size() > JOBS_HISTORY) {
+    finished.pop_front();
+  }
+}
+
+int JobsList::child_events[2] = {-1, -1};
+
+JobsList::JobsList() : jobs(), job_ids(), stopped_ids(), pid_index(), finished(), auto_place(false), core_load(),
+  rebalanced_ns(0) {
+  if (child_events[0] == -1 && pipe2(child_events, O_CLOEXEC | O_NONBLOCK) == -1) {
+    perror("smash error: pipe failed");
+    child_events[0] = child_events[1] = -1;
+  }
+}
+
+void JobsList::notifyChildEvent(pid_t pid, bool has_exited) {
+  // Called from the SIGCHLD handler, so only async-signal-safe calls here
+  if (child_events[1] == -1) return;
+  int saved_errno = errno;
+  ChildEvent event = {pid, has_exited, _monotonicNs()};
+  if (write(child_events[1], &event, sizeof(event)) == -1) {
+    // Pipe is full, a drain is already pending
+  }
+  errno = saved_errno;
+}
+
+void JobsList::updateJobState(pid_t pid, int status, const struct rusage& usage, long long exit_ns) {
+  auto it = pid_index.find(pid);
+  if (it == pid_index.end()) return;
+  int job_id = it->second;
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    // A pipeline job is done once its last stage exits
+    JobEntry& job = jobs.at(job_id);
+    job.usage.add(pid, status, usage);
+    vector<pid_t>& pids = job.pids;
+    pids.erase(std::remove(pids.begin(), pids.end(), pid), pids.end());
+    pid_index.erase(it);
+    if (pids.empty()) {
+      addFinished(job, exit_ns);
+      removeJobById(job_id);
+    }
+  } else if (WIFSTOPPED(status)) {
+    setStopped(&jobs.at(job_id), true);
+  } else if (WIFCONTINUED(status)) {
+    setStopped(&jobs.at(job_id), false);
+  }
+}
+
+void JobsList::removeFinishedJobs() {
+  if (child_events[0] == -1) return;
+  // Every write is one whole event, so reads return whole events too
+  ChildEvent events[8];
+  ssize_t bytes_read;
+  bool pending = false;
+  std::unordered_map<pid_t, long long> exit_ns;
+  while ((bytes_read = read(child_events[0], events, sizeof(events))) > 0) {
+    pending = true;
+    for (size_t i = 0; i < size_t(bytes_read) / sizeof(ChildEvent); i++) {
+      if (events[i].has_exited) exit_ns[events[i].pid] = events[i].time_ns;
+    }
+  }
+  if (!pending) return;
+  // One SIGCHLD may stand for several children, so drain until nothing is left. Children whose
+  // signals were merged have no exit time, they are taken as ending now.
+  int status;
+  pid_t pid;
+  struct rusage usage;
+  size_t running = jobs.size();
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+    Trace::instant("waitpid", pid, "status", status);
+    long long ended_ns = 0;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      SmallShell::getInstance().timed_jobs.cancelTimedJob(pid);
+      auto it = exit_ns.find(pid);
+      if (it != exit_ns.end()) ended_ns = it->second;
+    }
+    updateJobState(pid, status, usage, ended_ns);
+  }
+  if (jobs.size() < running) {
+    rebalance(true);
+  }
+}
+
+const std::vector<double>& CoreLoad::sample() {
+  // Deltas over a few milliseconds are mostly noise, so a recent sample is reused
+  long long now_ns = _monotonicNs();
+  if (sampled_ns != 0 && now_ns - sampled_ns < 100 * 1000000LL) return load;
+  sampled_ns = now_ns;
+  string stat;
+  if (!_readSmallFile("/proc/stat", stat)) return load;
+  istringstream lines(stat);
+  string line;
+  while (getline(lines, line)) {
+    int core;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    if (line.compare(0, 3, "cpu") != 0 || !isdigit((unsigned char)line[3]) ||
+        sscanf(line.c_str(), "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &core, &user, &nice, &system,
+               &idle, &iowait, &irq, &softirq, &steal) != 9 || core < 0 || core >= CPU_SETSIZE) {
+      continue;
+    }
+    if (core >= int(load.size())) {
+      busy.resize(core + 1, 0);
+      total.resize(core + 1, 0);
+      load.resize(core + 1, 0);
+    }
+    unsigned long long core_total = user + nice + system + idle + iowait + irq + softirq + steal;
+    unsigned long long core_busy = core_total - idle - iowait;
+    load[core] = core_total > total[core] ? double(core_busy - busy[core]) / (core_total - total[core]) : 0;
+    busy[core] = core_busy;
+    total[core] = core_total;
+  }
+  return load;
+}
+
+/**
+* The core smash may use with the lowest load, counting besides its utilization one full core for
+* every running job placed on it (other than moving), as a job that just started barely shows yet.
+*/
+int JobsList::leastLoadedCore(const JobEntry* moving) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) return -1;
+  vector<double> score = core_load.sample();
+  score.resize(std::max<size_t>(score.size(), get_nprocs_conf()), 0);
+  for (const auto& entry : jobs) {
+    const JobEntry& job = entry.second;
+    if (&job != moving && job.core >= 0 && job.core < int(score.size()) && !job.is_stopped) {
+      score[job.core] += 1;
+    }
+  }
+  int best = -1;
+  for (int core = 0; core < int(score.size()) && core < CPU_SETSIZE; core++) {
+    if (CPU_ISSET(core, &allowed) && (best == -1 || score[core] < score[best])) {
+      best = core;
+    }
+  }
+  return best;
+}
+
+static void _pinJob(JobsList::JobEntry* job, int core) {
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  CPU_SET(core, &cores);
+  _setJobAffinity(*job, cores);
+  job->core = core;
+}
+
+void JobsList::placeJob(JobEntry* job) {
+  int core = leastLoadedCore(job);
+  if (core != -1) {
+    _pinJob(job, core);
+  }
+}
+
+// Lets the job run on any core smash may use again
+void JobsList::releaseJob(JobEntry* job) {
+  if (job->core < 0) return;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    _setJobAffinity(*job, allowed);
+  }
+  job->core = -1;
+}
+
+/**
+* At most every PLACEMENT_INTERVAL_MS, or right away once jobs finished, moves the newest job of the
+* core with the most placed jobs to the least loaded core, for as long as that evens them out.
+*/
+void JobsList::rebalance(bool force) {
+  if (!auto_place) return;
+  long long now_ns = _monotonicNs();
+  if (!force && now_ns - rebalanced_ns < PLACEMENT_INTERVAL_MS * 1000000LL) return;
+  rebalanced_ns = now_ns;
+  for (size_t moves = 0; moves < jobs.size(); moves++) {
+    std::map<int, vector<JobEntry*>> by_core;
+    for (int id : job_ids) {
+      JobEntry& job = jobs.at(id);
+      if (job.core >= 0 && !job.is_stopped) by_core[job.core].push_back(&job);
+    }
+    auto busiest = std::max_element(by_core.begin(), by_core.end(), [](const pair<const int, vector<JobEntry*>>& a,
+                                    const pair<const int, vector<JobEntry*>>& b) { return a.second.size() < b.second.size(); });
+    if (busiest == by_core.end()) return;
+    JobEntry* job = busiest->second.back();
+    int target = leastLoadedCore(job);
+    size_t target_jobs = by_core.count(target) ? by_core[target].size() : 0;
+    if (target == -1 || busiest->second.size() < target_jobs + 2) return;
+    _pinJob(job, target);
+  }
+}
+
+void JobsList::killAllJobs() {
+  removeFinishedJobs();
+  cout << "smash: sending SIGKILL signal to " << jobs.size() << " jobs:" << endl;
+  for (int id : job_ids) {
+    const JobEntry& job = jobs.at(id);
+    cout << job.pid << ": " << job.cmd->original_cmd_line << endl;
+    if (job.sendSignal(SIGKILL) == -1){
+      perror("smash error: kill failed");
+    }
+  }
+}
+
+JobsList::JobEntry* JobsList::getJobById(int jobId) {
+  removeFinishedJobs();
+  auto it = jobs.find(jobId);
+  return it == jobs.end() ? nullptr : &it->second;
+}
+
+void JobsList::removeJobById(int jobId) {
+  auto it = jobs.find(jobId);
+  if (it == jobs.end()) return;
+  for (pid_t pid : it->second.pids) {
+    auto pid_it = pid_index.find(pid);
+    if (pid_it != pid_index.end() && pid_it->second == jobId) {
+      pid_index.erase(pid_it);
+    }
+  }
+  job_ids.erase(jobId);
+  stopped_ids.erase(jobId);
+  jobs.erase(it);
+}
+
+JobsList::JobEntry* JobsList::getLastJob(int* lastJobId) {
+  removeFinishedJobs();
+  if (job_ids.empty()) {
+    *lastJobId = -1;
+    return nullptr;
+  }
+  *lastJobId = *job_ids.rbegin();
+  return &jobs.at(*lastJobId);
+}
+
+JobsList::JobEntry* JobsList::getLastStoppedJob(int* lastJobId) {
+  removeFinishedJobs();
+  if (stopped_ids.empty()) {
+    *lastJobId = -1;
+    return nullptr;
+  }
+  *lastJobId = *stopped_ids.rbegin();
+  return &jobs.at(*lastJobId);
+}
+
+Trace::Event Trace::ring[TRACE_EVENTS];
+std::atomic<unsigned long> Trace::next(0);
+std::atomic<bool> Trace::enabled(false);
+static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS must be a power of two");
+
+long long Trace::now() {
+  return _monotonicNs();
+}
+
+void Trace::record(const char* name, long long start_ns, long long dur_ns, pid_t pid, const char* arg_name, long arg) {
+  unsigned long n = next.fetch_add(1, std::memory_order_relaxed);
+  Event& event = ring[n & (TRACE_EVENTS - 1)];
+  event.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  event.name = name;
+  event.start_ns = start_ns;
+  event.dur_ns = dur_ns;
+  event.pid = pid;
+  event.arg_name = arg_name;
+  event.arg = arg;
+  event.seq.store(n + 1, std::memory_order_release);
+}
+
+void Trace::start() {
+  enabled.store(false);
+  for (Event& event : ring) {
+    event.seq.store(0, std::memory_order_relaxed);
+  }
+  next.store(0);
+  enabled.store(true);
+}
+
+void Trace::stop() {
+  enabled.store(false);
+}
+
+/**
+* Writes the events in the ring to file_name in Chrome trace format, oldest first. Events about a
+* child are put on a thread of their own named by its pid.
+*/
+bool Trace::dump(const std::string& file_name) {
+  pid_t smash_pid = getpid();
+  ostringstream json;
+  json << fixed << setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+  unsigned long end = next.load(std::memory_order_acquire);
+  unsigned long first = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+  bool is_first = true;
+  for (unsigned long n = first; n < end; n++) {
+    Event& event = ring[n & (TRACE_EVENTS - 1)];
+    if (event.seq.load(std::memory_order_acquire) != n + 1) continue;
+    const char* name = event.name;
+    long long start_ns = event.start_ns;
+    long long dur_ns = event.dur_ns;
+    pid_t pid = event.pid;
+    const char* arg_name = event.arg_name;
+    long arg = event.arg;
+    // A signal handler may have reused the slot while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (event.seq.load(std::memory_order_relaxed) != n + 1) continue;
+
+    json << (is_first ? "\n" : ",\n") << "{\"name\": \"" << name << "\", \"ts\": " << start_ns / 1e3;
+    if (dur_ns < 0) {
+      json << ", \"ph\": \"i\", \"s\": \"t\"";
+    } else {
+      json << ", \"ph\": \"X\", \"dur\": " << dur_ns / 1e3;
+    }
+    json << ", \"pid\": " << smash_pid << ", \"tid\": " << (pid == 0 ? smash_pid : pid);
+    if (arg_name != nullptr) {
+      json << ", \"args\": {\"" << arg_name << "\": " << arg << "}";
+    }
+    json << "}";
+    is_first = false;
+  }
+  json << "\n]}\n";
+
+  int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    perror("smash error: open failed");
+    return false;
+  }
+  string data = json.str();
+  bool is_ok = _writeAll(fd, data.data(), data.size());
+  if (!is_ok) {
+    perror("smash error: write failed");
+  }
+  close(fd);
+  return is_ok;
+}
+
+void TraceCommand::execute() {
+  // trace start | trace stop | trace dump <file>
+  if (num_of_args == 2 && strcmp(args[1], "start") == 0) {
+    Trace::start();
+  } else if (num_of_args == 2 && strcmp(args[1], "stop") == 0) {
+    Trace::stop();
+  } else if (num_of_args == 3 && strcmp(args[1], "dump") == 0) {
+    Trace::dump(args[2]);
+  } else {
+    cerr << "smash error: trace: invalid arguments" << endl;
+  }
+}
+
+Histogram::Histogram() : counts(), total(0), sum_ns(0), max_ns(0) {}
+
+int Histogram::bucketOf(long long value) {
+  if (value < SUB_BUCKETS) return value < 0 ? 0 : int(value);
+  int exp = 63 - __builtin_clzll(value);
+  return SUB_BUCKETS + (exp - 4) * SUB_BUCKETS + int((value >> (exp - 4)) - SUB_BUCKETS);
+}
+
+// The largest value that falls in bucket
+long long Histogram::bucketEnd(int bucket) {
+  if (bucket < SUB_BUCKETS) return bucket;
+  int exp = (bucket - SUB_BUCKETS) / SUB_BUCKETS + 4;
+  unsigned long long sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+  unsigned long long end = ((SUB_BUCKETS + sub + 1) << (exp - 4)) - 1;
+  return (long long)std::min(end, (unsigned long long)LLONG_MAX);
+}
+
+void Histogram::record(long long value) {
+  counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  sum_ns.fetch_add(value, std::memory_order_relaxed);
+  long long seen = max_ns.load(std::memory_order_relaxed);
+  while (value > seen && !max_ns.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+long long Histogram::percentile(double p) const {
+  unsigned long target = (unsigned long)ceil(count() * p / 100);
+  unsigned long seen = 0;
+  for (int bucket = 0; bucket < BUCKETS && target > 0; bucket++) {
+    seen += counts[bucket].load(std::memory_order_relaxed);
+    if (seen >= target) return std::min(bucketEnd(bucket), max());
+  }
+  return max();
+}
+
+unsigned long Histogram::countUpTo(long long value) const {
+  unsigned long seen = 0;
+  for (int bucket = 0; bucket < BUCKETS && bucketEnd(bucket) <= value; bucket++) {
+    seen += counts[bucket].load(std::memory_order_relaxed);
+  }
+  return seen;
+}
+
+std::atomic<unsigned long> Stats::commands[Stats::KINDS];
+std::atomic<unsigned long> Stats::jobs_reaped(0);
+std::atomic<unsigned long> Stats::timeouts_fired(0);
+std::atomic<unsigned long> Stats::signals_forwarded(0);
+Histogram Stats::launch_ns;
+Histogram Stats::foreground_ns;
+
+static const char* const STATS_KINDS[Stats::KINDS] = {"builtin", "external", "pipe", "redirect", "timeout"};
+// Upper bounds in seconds of the buckets exported to Prometheus
+static const double STATS_BOUNDS[] = {1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3, 5e-3, 0.01, 0.025,
+                                      0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60};
+// Bumped to stop the exporter thread that runs
+static std::atomic<unsigned> stats_export_generation(0);
+
+static void _printHistogram(const char* name, const Histogram& histogram) {
+  unsigned long count = histogram.count();
+  cout << name << ": count " << count << fixed << setprecision(1)
+       << ", mean " << (count == 0 ? 0 : histogram.sum() / 1e3 / count) << " us";
+  for (double p : {50.0, 90.0, 99.0}) {
+    cout << ", p" << int(p) << " " << histogram.percentile(p) / 1e3 << " us";
+  }
+  cout << ", max " << histogram.max() / 1e3 << " us" << endl;
+  cout << setprecision(6);
+  cout.unsetf(ios::floatfield);
+}
+
+void Stats::print() {
+  cout << "commands:";
+  for (int kind = 0; kind < KINDS; kind++) {
+    cout << (kind == 0 ? " " : ", ") << STATS_KINDS[kind] << " " << commands[kind].load();
+  }
+  cout << endl;
+  cout << "jobs reaped " << jobs_reaped.load() << ", timeouts fired " << timeouts_fired.load()
+       << ", signals forwarded " << signals_forwarded.load() << endl;
+  _printHistogram("launch", launch_ns);
+  _printHistogram("foreground", foreground_ns);
+}
+
+static void _prometheusHistogram(ostringstream& text, const char* name, const char* help, const Histogram& histogram) {
+  text << "# HELP " << name << " " << help << "\n# TYPE " << name << " histogram\n";
+  for (double bound : STATS_BOUNDS) {
+    text << name << "_bucket{le=\"" << bound << "\"} " << histogram.countUpTo(llround(bound * 1e9)) << "\n";
+  }
+  text << name << "_bucket{le=\"+Inf\"} " << histogram.count() << "\n";
+  text << name << "_sum " << histogram.sum() / 1e9 << "\n";
+  text << name << "_count " << histogram.count() << "\n";
+}
+
+// The counters in the Prometheus text exposition format
+std::string Stats::prometheus() {
+  ostringstream text;
+  text << "# HELP smash_commands_total Commands run, by kind.\n# TYPE smash_commands_total counter\n";
+  for (int kind = 0; kind < KINDS; kind++) {
+    text << "smash_commands_total{kind=\"" << STATS_KINDS[kind] << "\"} " << commands[kind].load() << "\n";
+  }
+  const pair<const char*, const std::atomic<unsigned long>*> counters[] = {
+    {"smash_jobs_reaped_total", &jobs_reaped},
+    {"smash_timeouts_fired_total", &timeouts_fired},
+    {"smash_signals_forwarded_total", &signals_forwarded},
+  };
+  for (const auto& counter : counters) {
+    text << "# TYPE " << counter.first << " counter\n" << counter.first << " " << counter.second->load() << "\n";
+  }
+  _prometheusHistogram(text, "smash_launch_seconds", "Time to fork or spawn a command.", launch_ns);
+  _prometheusHistogram(text, "smash_foreground_seconds", "Time spent waiting on foreground jobs.", foreground_ns);
+  return text.str();
+}
+
+// Replaces file_name at once, so a scrape never sees it half written
+static bool _writeStatsFile(const string& file_name, bool report_errors) {
+  string target, temp_name;
+  int out = _createTempFile(file_name, target, temp_name);
+  if (out == -1) {
+    if (report_errors) perror("smash error: open failed");
+    return false;
+  }
+  string data = Stats::prometheus();
+  if (!_writeAll(out, data.data(), data.size())) {
+    _discardTempFile(out, temp_name);
+    if (report_errors) perror("smash error: write failed");
+    return false;
+  }
+  const char* failed_call = _commitTempFile(out, 0644, temp_name, target);
+  if (failed_call != nullptr) {
+    if (report_errors) perror(("smash error: " + string(failed_call) + " failed").c_str());
+    return false;
+  }
+  return true;
+}
+
+void Stats::startExport(const std::string& file_name, int interval) {
+  unsigned generation = ++stats_export_generation;
+  if (!_writeStatsFile(file_name, true)) return;
+  // Signals for smash must reach the main thread, so the exporter starts with all of them blocked
+  sigset_t all_signals, old_set;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_set);
+  try {
+    std::thread([file_name, interval, generation]() {
+      while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(interval));
+        if (stats_export_generation.load() != generation) return;
+        _writeStatsFile(file_name, false);
+      }
+    }).detach();
+  } catch (const std::system_error& e) {
+    cerr << "smash error: stats: " << e.what() << endl;
+  }
+  pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+}
+
+void Stats::stopExport() {
+  ++stats_export_generation;
+}
+
+void StatsCommand::execute() {
+  // stats | stats -p <file> <seconds> | stats -p off
+  if (num_of_args == 1) {
+    Stats::print();
+  } else if (num_of_args == 3 && strcmp(args[1], "-p") == 0 && strcmp(args[2], "off") == 0) {
+    Stats::stopExport();
+  } else if (num_of_args == 4 && strcmp(args[1], "-p") == 0) {
+    char* end;
+    long interval = strtol(args[3], &end, 10);
+    if (*end != '\0' || interval < 1 || interval > INT_MAX) {
+      cerr << "smash error: stats: invalid arguments" << endl;
+      return;
+    }
+    Stats::startExport(args[2], interval);
+  } else {
+    cerr << "smash error: stats: invalid arguments" << endl;
+  }
+}
+
+void CmdCacheCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  if (num_of_args == 1) {
+    smash.printPlanCache();
+  }
+  else if (num_of_args == 2 && strcmp(args[1], "-r") == 0) {
+    smash.clearPlanCache();
+  }
+  else {
+    cerr << "smash error: cmdcache: invalid arguments" << endl;
+  }
+}
+
+/**
+* Copies the rest of in to out without passing it through user space when the kernel can:
+* copy_file_range between regular files, sendfile from a regular file, splice to or from a pipe
+* unless out is a regular file, read and write otherwise.
+* Each call advances the file offsets, so a later method picks up where an earlier one gave up.
+* splice is not used into a file: out may share its offset with smash (cat | ... > log), and a
+* splice stopped or killed midway writes back a stale offset over what smash printed since.
+*/
+static bool _copyFd(int in, int out) {
+  const size_t chunk = 1 << 30;
+  // A failed fstat leaves the mode 0, and the copy reports the error
+  struct stat in_st = {}, out_st = {};
+  fstat(in, &in_st);
+  fstat(out, &out_st);
+  bool in_regular = S_ISREG(in_st.st_mode);
+  bool out_regular = S_ISREG(out_st.st_mode);
+  ssize_t n;
+  if (in_regular && out_regular) {
+    while ((n = copy_file_range(in, nullptr, out, nullptr, chunk, 0)) > 0 || (n == -1 && errno == EINTR)) {}
+    if (n == 0) return true;
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EBADF && errno != EOPNOTSUPP) return false;
+  }
+  if (in_regular) {
+    while ((n = sendfile(out, in, nullptr, chunk)) > 0 || (n == -1 && errno == EINTR)) {}
+    if (n == 0) return true;
+    if (errno != EINVAL && errno != ENOSYS) return false;
+  }
+  if ((S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) && !out_regular) {
+    while ((n = splice(in, nullptr, out, nullptr, chunk, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0 ||
+           (n == -1 && errno == EINTR)) {}
+    if (n == 0) return true;
+    if (errno != EINVAL && errno != ENOSYS) return false;
+  }
+  char buffer[64 * 1024];
+  while ((n = read(in, buffer, sizeof(buffer))) != 0) {
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    for (ssize_t written = 0; written < n; ) {
+      ssize_t w = write(out, buffer + written, n - written);
+      if (w == -1) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      written += w;
+    }
+  }
+  return true;
+}
+
+// cat and sleep run in a forked child, so what they do not implement is left to the binary itself
+static void _execBinary(char** args) {
+  execvp(args[0], args);
+  perror("smash error: execvp failed");
+  exit(1);
+}
+
+void EchoCommand::execute() {
+  bool newline = true;
+  bool escapes = false;
+  int i = 1;
+  // Leading -n, -e and -E and combinations of them are options, anything else is printed
+  for (; i < num_of_args && args[i][0] == '-' && args[i][1] != '\0'
+         && strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++) {
+    for (const char* flag = args[i] + 1; *flag; flag++) {
+      if (*flag == 'n') newline = false;
+      else escapes = *flag == 'e';
+    }
+  }
+  for (int first = i; i < num_of_args; i++) {
+    if (i > first) cout << ' ';
+    if (!escapes) {
+      cout << args[i];
+      continue;
+    }
+    for (const char* c = args[i]; *c; c++) {
+      if (*c != '\\' || c[1] == '\0') {
+        cout << *c;
+        continue;
+      }
+      switch (*++c) {
+        case 'a': cout << '\a'; break;
+        case 'b': cout << '\b'; break;
+        case 'c': cout.flush(); return;
+        case 'e': cout << '\033'; break;
+        case 'f': cout << '\f'; break;
+        case 'n': cout << '\n'; break;
+        case 'r': cout << '\r'; break;
+        case 't': cout << '\t'; break;
+        case 'v': cout << '\v'; break;
+        case '\\': cout << '\\'; break;
+        case '0': {
+          int value = 0;
+          for (int digits = 0; digits < 3 && c[1] >= '0' && c[1] <= '7'; digits++) {
+            value = value * 8 + (*++c - '0');
+          }
+          cout << (char)value;
+          break;
+        }
+        default: cout << '\\' << *c;
+      }
+    }
+  }
+  if (newline) cout << endl;
+}
+
+static bool _testInteger(const char* arg, long long& value) {
+  char* end;
+  errno = 0;
+  value = strtoll(arg, &end, 10);
+  if (end == arg || *_trim(end).c_str() != '\0' || errno == ERANGE) {
+    cerr << "test: " << arg << ": integer expression expected" << endl;
+    return false;
+  }
+  return true;
+}
+
+/**
+* Evaluates the test expression args[0..count) by the POSIX rules for up to four arguments.
+* Returns 0 when it is true, 1 when it is false and 2 on a malformed expression.
+*/
+static int _evalTest(char** args, int count) {
+  struct stat st;
+  if (count == 0) return 1;
+  if (count == 1) return args[0][0] == '\0';
+  if (count == 2) {
+    if (strcmp(args[0], "!") == 0) {
+      int result = _evalTest(args + 1, 1);
+      return result == 2 ? 2 : !result;
+    }
+    const char* op = args[0];
+    const char* arg = args[1];
+    if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+      cerr << "test: " << op << ": unary operator expected" << endl;
+      return 2;
+    }
+    switch (op[1]) {
+      case 'z': return arg[0] != '\0';
+      case 'n': return arg[0] == '\0';
+      case 'e': return stat(arg, &st) != 0;
+      case 'f': return !(stat(arg, &st) == 0 && S_ISREG(st.st_mode));
+      case 'd': return !(stat(arg, &st) == 0 && S_ISDIR(st.st_mode));
+      case 's': return !(stat(arg, &st) == 0 && st.st_size > 0);
+      case 'h':
+      case 'L': return !(lstat(arg, &st) == 0 && S_ISLNK(st.st_mode));
+      case 'r': return access(arg, R_OK) != 0;
+      case 'w': return access(arg, W_OK) != 0;
+      case 'x': return access(arg, X_OK) != 0;
+    }
+    cerr << "test: " << op << ": unary operator expected" << endl;
+    return 2;
+  }
+  if (count == 3) {
+    const char* op = args[1];
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(args[0], args[2]) != 0;
+    if (strcmp(op, "!=") == 0) return strcmp(args[0], args[2]) == 0;
+    static const char* const int_ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    for (int i = 0; i < 6; i++) {
+      if (strcmp(op, int_ops[i]) != 0) continue;
+      long long left, right;
+      if (!_testInteger(args[0], left) || !_testInteger(args[2], right)) return 2;
+      bool results[] = {left == right, left != right, left < right, left <= right, left > right, left >= right};
+      return !results[i];
+    }
+    if (strcmp(args[0], "!") == 0) {
+      int result = _evalTest(args + 1, 2);
+      return result == 2 ? 2 : !result;
+    }
+    if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0) return _evalTest(args + 1, 1);
+    cerr << "test: " << op << ": binary operator expected" << endl;
+    return 2;
+  }
+  if (count == 4 && strcmp(args[0], "!") == 0) {
+    int result = _evalTest(args + 1, 3);
+    return result == 2 ? 2 : !result;
+  }
+  cerr << "test: too many arguments" << endl;
+  return 2;
+}
+
+void TestCommand::execute() {
+  exit_status = _evalTest(args + 1, num_of_args - 1);
+}
+
+CatCommand::CatCommand(const CommandPlan& plan) : BuiltInCommand(plan) {
+  // Runs in its own child, so it can be a background job like the binary
+  is_background = plan.is_background;
+}
+
+void CatCommand::execute() {
+  for (int i = 1; i < num_of_args; i++) {
+    if (args[i][0] == '-' && args[i][1] != '\0') _execBinary(args);
+  }
+  if (num_of_args == 1 && !_copyFd(STDIN_FILENO, STDOUT_FILENO)) {
+    cerr << "cat: -: " << strerror(errno) << endl;
+    exit_status = 1;
+  }
+  for (int i = 1; i < num_of_args; i++) {
+    bool is_stdin = strcmp(args[i], "-") == 0;
+    int fd = is_stdin ? STDIN_FILENO : open(args[i], O_RDONLY);
+    if (fd == -1 || !_copyFd(fd, STDOUT_FILENO)) {
+      cerr << "cat: " << args[i] << ": " << strerror(errno) << endl;
+      exit_status = 1;
+    }
+    if (fd != -1 && !is_stdin) close(fd);
+  }
+}
+
+SleepCommand::SleepCommand(const CommandPlan& plan) : BuiltInCommand(plan) {
+  is_background = plan.is_background;
+}
+
+void SleepCommand::execute() {
+  // The binary reports a missing or malformed interval
+  if (num_of_args == 1) _execBinary(args);
+  double seconds = 0;
+  for (int i = 1; i < num_of_args; i++) {
+    char* end;
+    double value = strtod(args[i], &end);
+    double unit = 1;
+    if (*end != '\0' && end[1] == '\0') {
+      unit = *end == 's' ? 1 : *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 0;
+      end++;
+    }
+    if (end == args[i] || *end != '\0' || unit == 0 || !(value >= 0) || !isdigit((unsigned char)args[i][0])) {
+      _execBinary(args);
+    }
+    seconds += value * unit;
+  }
+  struct timespec remaining;
+  remaining.tv_sec = seconds >= (double)LONG_MAX ? LONG_MAX : (time_t)seconds;
+  remaining.tv_nsec = seconds >= (double)LONG_MAX ? 0 : (long)((seconds - remaining.tv_sec) * 1e9);
+  while (nanosleep(&remaining, &remaining) == -1 && errno == EINTR) {}
+}
+
+/**
+* Pushes megabytes of data from a writer child through a pipe sized like those of pipelines (or as
+* given by -s) into a reader child that splices it to /dev/null, and reports the throughput.
+*/
+void PipeBenchCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  int pipe_size = smash.pipeSize();
+  long long megabytes = PIPEBENCH_MB;
+  int i = 1;
+  if (i + 1 < num_of_args && strcmp(args[i], "-s") == 0) {
+    pipe_size = _parsePipeSize(args[i + 1]);
+    i += 2;
+  }
+  if (i < num_of_args) {
+    char* end;
+    megabytes = strtoll(args[i], &end, 10);
+    if (end == args[i] || *end != '\0') megabytes = 0;
+    i++;
+  }
+  if (pipe_size < 0 || megabytes <= 0 || i != num_of_args) {
+    cerr << "smash error: pipebench: invalid arguments" << endl;
+    return;
+  }
+  int fds[2];
+  if (_makePipe(fds, pipe_size) != 0) {
+    perror("smash error: pipe failed");
+    return;
+  }
+  int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+  SmallShell::flushOutput();
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t writer = fork();
+  if (writer == 0) {
+    static char block[1024 * 1024];
+    close(fds[0]);
+    for (long long n = 0; n < megabytes; n++) {
+      for (size_t written = 0; written < sizeof(block); ) {
+        ssize_t w = write(fds[1], block + written, sizeof(block) - written);
+        if (w == -1 && errno != EINTR) _exit(1);
+        if (w > 0) written += w;
+      }
+    }
+    _exit(0);
+  }
+  pid_t reader = writer == -1 ? -1 : fork();
+  if (reader == 0) {
+    close(fds[1]);
+    int null_fd = open("/dev/null", O_WRONLY);
+    _exit(null_fd != -1 && _copyFd(fds[0], null_fd) ? 0 : 1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if (writer == -1 || reader == -1) {
+    perror("smash error: fork failed");
+    if (writer != -1) waitpid(writer, nullptr, 0);
+    return;
+  }
+  int writer_status, reader_status;
+  waitpid(writer, &writer_status, 0);
+  waitpid(reader, &reader_status, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (!WIFEXITED(writer_status) || WEXITSTATUS(writer_status) != 0 ||
+      !WIFEXITED(reader_status) || WEXITSTATUS(reader_status) != 0) {
+    cerr << "smash error: pipebench: transfer failed" << endl;
+    return;
+  }
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  cout << "pipebench: " << megabytes << " MB through a " << capacity << " byte pipe in "
+       << fixed << setprecision(3) << seconds << " s, " << setprecision(1) << megabytes / seconds
+       << " MB/s" << endl;
+  cout.unsetf(ios::floatfield);
+  cout << setprecision(6);
+}
+
+LoadedBuiltin::~LoadedBuiltin() {
+  dlclose(handle);
+}
+
+LoadedCommand::LoadedCommand(const CommandPlan& plan) : Command(plan), builtin(plan.loaded) {
+  // Only a builtin running in its own child can be left in the background
+  if (!builtin->is_unsafe) {
+    is_background = false;
+  }
+}
+
+void LoadedCommand::execute() {
+  // The builtin writes to the fds directly, after what smash buffered and before what it buffers next
+  SmallShell::flushOutput();
+  builtin->entry(num_of_args, args, stdio);
+  fflush(stdout);
+  fflush(stderr);
+}
+
+void EnableCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  if (num_of_args == 1) {
+    smash.printLoadedBuiltins();
+  }
+  else if (num_of_args >= 4 && strcmp(args[1], "-f") == 0) {
+    for (int i = 3; i < num_of_args; i++) {
+      if (!smash.loadBuiltin(args[2], args[i])) return;
+    }
+  }
+  else if (num_of_args >= 3 && strcmp(args[1], "-d") == 0) {
+    for (int i = 2; i < num_of_args; i++) {
+      if (!smash.unloadBuiltin(args[i])) {
+        cerr << "smash error: enable: " << args[i] << ": not a loaded builtin" << endl;
+      }
+    }
+  }
+  else {
+    cerr << "smash error: enable: invalid arguments" << endl;
+  }
+}
+
+void HashCommand::execute() {
+  SmallShell& smash = SmallShell::getInstance();
+  if (num_of_args == 1) {
+    smash.printExecCache();
+    return;
+  }
+  if (strcmp(args[1], "-r") == 0) {
+    if (num_of_args != 2) {
+      cerr << "smash error: hash: invalid arguments" << endl;
+      return;
+    }
+    smash.clearExecCache();
+    return;
+  }
+  for (int i = 1; i < num_of_args; i++) {
+    if (smash.resolveExecutable(args[i]).empty()) {
+      cerr << "smash error: hash: " << args[i] << ": not found" << endl;
+    }
+  }
+}
+
+// Modification time of path in ns, -1 if it cannot be read
+static long long _mtimeNs(const string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) == -1) return -1;
+  return st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+void SmallShell::validateExecCache() {
+  const char* path_env = getenv("PATH");
+  string path = path_env == nullptr ? "/bin:/usr/bin" : path_env;
+  bool is_stale = path != exec_cache_path;
+  for (size_t i = 0; !is_stale && i < exec_cache_dirs.size(); i++) {
+    is_stale = _mtimeNs(exec_cache_dirs[i].first) != exec_cache_dirs[i].second;
+  }
+  if (!is_stale) return;
+
+  exec_cache.clear();
+  exec_cache_dirs.clear();
+  exec_cache_path = path;
+  size_t start = 0;
+  while (start <= path.length()) {
+    size_t end = path.find(':', start);
+    if (end == string::npos) end = path.length();
+    string dir = path.substr(start, end - start);
+    if (dir.empty()) dir = ".";
+    exec_cache_dirs.push_back({dir, _mtimeNs(dir)});
+    start = end + 1;
+  }
+}
+
+/**
+* Maps a command name to the executable execv should run, walking $PATH (then /bin/) only on a cache miss.
+* Returns an empty string if nothing executable was found.
+*/
+string SmallShell::resolveExecutable(const string& name) {
+  if (name.find('/') != string::npos) {
+    return name;
+  }
+  validateExecCache();
+  auto it = exec_cache.find(name);
+  if (it != exec_cache.end()) {
+    it->second.hits++;
+    return it->second.path;
+  }
+
+  vector<string> candidates;
+  for (const auto& dir : exec_cache_dirs) {
+    candidates.push_back(dir.first + "/" + name);
+  }
+  candidates.push_back("/bin/" + name);
+  struct stat st;
+  for (const string& candidate : candidates) {
+    if (access(candidate.c_str(), X_OK) == 0 && stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      exec_cache[name] = {candidate, 0};
+      return candidate;
+    }
+  }
+  return "";
+}
+
+void SmallShell::clearExecCache() {
+  exec_cache.clear();
+}
+
+void SmallShell::printExecCache() {
+  validateExecCache();
+  if (exec_cache.empty()) {
+    cout << "smash: hash table empty" << endl;
+    return;
+  }
+  cout << "hits\tcommand" << endl;
+  for (const auto& entry : exec_cache) {
+    cout << setw(4) << entry.second.hits << "\t" << entry.second.path << endl;
+  }
+}
+
+SmallShell::SmallShell() : title("smash"), last_wd(), use_spawn(true), use_native_utils(true), pipe_size(0), exec_cache(), exec_cache_path(), exec_cache_dirs(), plan_cache(), plan_index(),
+  plan_hits(0), plan_misses(0), loaded_builtins(), job_list(), timed_jobs(), fg_job(),
+  fg_usage() {
+  // SMASH_LAUNCH=fork falls back to fork+exec for external commands
+  const char* launch_mode = getenv("SMASH_LAUNCH");
+  if (launch_mode != nullptr && strcmp(launch_mode, "fork") == 0) {
+    use_spawn = false;
+  }
+  // SMASH_PIPE_SIZE sets the capacity of pipeline pipes, in bytes or "max"
+  const char* pipe_size_env = getenv("SMASH_PIPE_SIZE");
+  if (pipe_size_env != nullptr) {
+    pipe_size = max(_parsePipeSize(pipe_size_env), 0);
+  }
+  // SMASH_PLACEMENT=auto pins each background job to the least loaded core
+  const char* placement = getenv("SMASH_PLACEMENT");
+  if (placement != nullptr && strcmp(placement, "auto") == 0) {
+    job_list.auto_place = true;
+  }
+  // SMASH_COREUTILS=external runs echo, cat and the like from $PATH rather than as builtins
+  const char* coreutils = getenv("SMASH_COREUTILS");
+  if (coreutils != nullptr && strcmp(coreutils, "external") == 0) {
+    use_native_utils = false;
+  }
+}
+
+// Applies action to the calling process, which is a child about to run its command
+static bool _applyFdAction(const FdAction& action) {
+  if (action.source == FdAction::CLOSE) {
+    close(action.fd);
+    return true;
+  }
+  if (action.source != FdAction::OPEN) {
+    if (dup2(action.source, action.fd) != -1) return true;
+    perror("smash error: dup2 failed");
+    return false;
+  }
+  int fd = open(action.path.c_str(), action.flags, S_IRWXU | S_IRWXO | S_IRWXG);
+  if (fd == -1) {
+    perror("smash error: open failed");
+    return false;
+  }
+  if (fd != action.fd) {
+    dup2(fd, action.fd);
+    close(fd);
+  }
+  return true;
+}
+
+/**
+* Starts cmd as a child in process group pgid (a new group when 0). In the child, fd_actions are
+* applied first and then the redirections of cmd.
+* External commands go through posix_spawn unless the fork backend was selected.
+*/
+pid_t SmallShell::launchCommand(Command* cmd, const vector<FdAction>& fd_actions, pid_t pgid) {
+  // The child must neither lose nor repeat what smash has buffered so far
+  flushOutput();
+  ExternalCommand* ext_cmd = cmd->policy == CommandPlan::RUN_IN_CHILD ? static_cast<ExternalCommand*>(cmd) : nullptr;
+  if (ext_cmd && !ext_cmd->is_complex) {
+    if (ext_cmd->has_wildcards) ext_cmd->expandWildcards();
+    if (ext_cmd->num_of_args == 0) return -1;
+    ext_cmd->exec_path = resolveExecutable(ext_cmd->args[0]);
+  }
+  if (ext_cmd && use_spawn) {
+    // Files are opened here rather than by posix_spawn, so a failed open is told apart from a failed
+    // exec. They are kept above every fd the actions name, where no dup2 or close can touch them.
+    vector<int> opened;
+    int min_fd = 3;
+    for (const vector<FdAction>* list : {&fd_actions, &cmd->fd_actions}) {
+      for (const FdAction& action : *list) {
+        min_fd = max({min_fd, action.fd + 1, action.source + 1});
+      }
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    bool is_ready = true;
+    for (const vector<FdAction>* list : {&fd_actions, &cmd->fd_actions}) {
+      if (!is_ready) break;
+      for (const FdAction& action : *list) {
+        if (action.source == FdAction::OPEN) {
+          // Non-blocking, so reading from a FIFO with no writer yet blocks the command and not smash
+          int fd = open(action.path.c_str(), action.flags | O_CLOEXEC | O_NONBLOCK, S_IRWXU | S_IRWXO | S_IRWXG);
+          if (fd == -1) {
+            perror("smash error: open failed");
+            is_ready = false;
+            break;
+          }
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+          if (fd < min_fd) {
+            int high_fd = fcntl(fd, F_DUPFD_CLOEXEC, min_fd);
+            if (high_fd == -1) perror("smash error: fcntl failed");
+            close(fd);
+            fd = high_fd;
+            is_ready = fd != -1;
+            if (!is_ready) break;
+          }
+          opened.push_back(fd);
+          posix_spawn_file_actions_adddup2(&actions, fd, action.fd);
+        } else if (action.source == FdAction::CLOSE) {
+          posix_spawn_file_actions_addclose(&actions, action.fd);
+        } else {
+          posix_spawn_file_actions_adddup2(&actions, action.source, action.fd);
+        }
+      }
+    }
+    pid_t pid = -1;
+    if (is_ready) {
+      // posix_spawn returns once the child has exec'd, so this covers the exec too
+      long long start_ns = Trace::now();
+      pid = ext_cmd->spawn(&actions, &attr);
+      Stats::launch_ns.record(Trace::now() - start_ns);
+      Trace::complete("spawn", start_ns, pid == -1 ? 0 : pid);
+    }
+    for (int fd : opened) {
+      close(fd);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+  }
+
+  // While tracing, a child about to exec sends the time, and exec closes the pipe once it succeeded
+  int exec_pipe[2] = {-1, -1};
+  if (ext_cmd && Trace::isEnabled() && pipe2(exec_pipe, O_CLOEXEC) == -1) {
+    exec_pipe[0] = exec_pipe[1] = -1;
+  }
+  long long start_ns = Trace::now();
+  pid_t pid = fork();
+  if (pid == -1) {
+    perror("smash error: fork failed");
+    if (exec_pipe[0] != -1) {
+      close(exec_pipe[0]);
+      close(exec_pipe[1]);
+    }
+    return -1;
+  }
+  if (pid == 0) {
+    setpgid(0, pgid);
+    if (exec_pipe[1] != -1) {
+      close(exec_pipe[0]);
+      long long exec_ns = Trace::now();
+      _writeAll(exec_pipe[1], (const char*)&exec_ns, sizeof(exec_ns));
+    }
+    // exec would reset these, a builtin running in the child must not run the handlers of smash
+    for (int sig : {SIGTSTP, SIGINT, SIGALRM, SIGCHLD, SIGXFSZ}) {
+      signal(sig, SIG_DFL);
+    }
+    for (const vector<FdAction>* list : {&fd_actions, &cmd->fd_actions}) {
+      for (const FdAction& action : *list) {
+        if (!_applyFdAction(action)) exit(1);
+      }
+    }
+    cmd->execute();
+    exit(cmd->exit_status);
+  }
+  // Also set it from the parent so the group exists before the next pipeline stage joins it
+  setpgid(pid, pgid == 0 ? pid : pgid);
+  Stats::launch_ns.record(Trace::now() - start_ns);
+  Trace::complete("fork", start_ns, pid);
+  if (exec_pipe[1] != -1) {
+    close(exec_pipe[1]);
+    long long exec_ns;
+    ssize_t bytes_read;
+    while ((bytes_read = read(exec_pipe[0], &exec_ns, sizeof(exec_ns))) == -1 && errno == EINTR) {}
+    if (bytes_read == sizeof(exec_ns)) {
+      char c;
+      while (read(exec_pipe[0], &c, 1) != 0 && errno == EINTR) {}
+      Trace::complete("exec", exec_ns, pid);
+    }
+    close(exec_pipe[0]);
+  }
+  return pid;
+}
+
+/**
+* Runs the given processes as the foreground job and waits until they all exit or one of them stops.
+* A job brought back from the list passes its usage so far, so the accounting continues.
+*/
+void SmallShell::waitForeground(shared_ptr<Command> cmd, const vector<pid_t>& pids, int job_id,
+                                const JobsList::JobEntry::Usage* usage) {
+  if (pids.empty()) return;
+  flushOutput();
+  long long start_ns = Trace::now();
+  fg_job = new JobsList::JobEntry(job_id, cmd, pids);
+  if (usage != nullptr) {
+    fg_job->usage = *usage;
+  }
+  int stop_status = -1;
+  while (!fg_job->pids.empty()) {
+    int status;
+    struct rusage child_usage;
+    pid_t pid = fg_job->pids.front();
+    if (wait4(pid, &status, WUNTRACED, &child_usage) != -1) {
+      Trace::instant("waitpid", pid, "status", status);
+      if (WIFSTOPPED(status)) {
+        stop_status = status;
+        break;
+      }
+      fg_job->usage.add(pid, status, child_usage);
+    }
+    timed_jobs.cancelTimedJob(pid);
+    fg_job->pids.erase(fg_job->pids.begin());
+  }
+  fg_usage = fg_job->usage;
+  if (stop_status != -1) {
+    fg_usage.status = stop_status;
+  } else {
+    job_list.addFinished(*fg_job);
+  }
+  delete fg_job;
+  fg_job = nullptr;
+  Stats::foreground_ns.record(Trace::now() - start_ns);
+}
+
+OutputBuffer::OutputBuffer(int fd) : std::streambuf(), buffer(), fd(fd) {
+  setp(buffer, buffer + sizeof(buffer));
+}
+
+int OutputBuffer::overflow(int c) {
+  flush();
+  if (c != traits_type::eof()) {
+    *pptr() = c;
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+void OutputBuffer::flush() {
+  const char* data = pbase();
+  size_t length = pptr() - pbase();
+  setp(buffer, buffer + sizeof(buffer));
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written == -1) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    data += written;
+    length -= written;
+  }
+}
+
+static OutputBuffer* output_buffer = nullptr;
+static std::streambuf* cout_buffer = nullptr;
+// Where cout and cerr go while a builtin run by smash is redirected
+static OutputBuffer* redirected_output[2] = {nullptr, nullptr};
+
+BuiltinRedirection::BuiltinRedirection(Command* cmd) : is_ready(true), opened(), buffers(),
+  saved_cout(nullptr), saved_cerr(nullptr), err_file(nullptr), saved_stderr(nullptr) {
+  if (cmd->fd_actions.empty()) return;
+  int* fds = cmd->stdio;
+  for (const FdAction& action : cmd->fd_actions) {
+    int target = action.source;
+    if (action.source == FdAction::OPEN) {
+      target = open(action.path.c_str(), action.flags | O_CLOEXEC, S_IRWXU | S_IRWXO | S_IRWXG);
+      if (target == -1) {
+        perror("smash error: open failed");
+        is_ready = false;
+        return;
+      }
+      opened.push_back(target);
+    }
+    else if (action.source >= 0 && action.source <= 2) {
+      target = fds[action.source];
+    }
+    if (action.fd >= 0 && action.fd <= 2) {
+      fds[action.fd] = target;
+    }
+  }
+  // Whatever smash printed before goes out before the builtin prints anything
+  SmallShell::flushOutput();
+  if (fds[1] != STDOUT_FILENO) {
+    buffers[0].reset(new OutputBuffer(fds[1]));
+    redirected_output[0] = buffers[0].get();
+    saved_cout = cout.rdbuf(buffers[0].get());
+  }
+  if (fds[2] != STDERR_FILENO) {
+    OutputBuffer* err_buffer = buffers[0] && fds[2] == fds[1] ? buffers[0].get() : nullptr;
+    if (err_buffer == nullptr) {
+      buffers[1].reset(new OutputBuffer(fds[2]));
+      err_buffer = buffers[1].get();
+    }
+    redirected_output[1] = buffers[1].get();
+    saved_cerr = cerr.rdbuf(err_buffer);
+    // perror writes through stdio, give it a stream over the same file
+    int err_fd = dup(fds[2]);
+    if (err_fd != -1 && (err_file = fdopen(err_fd, "w")) != nullptr) {
+      setvbuf(err_file, nullptr, _IONBF, 0);
+      saved_stderr = stderr;
+      stderr = err_file;
+    }
+    else if (err_fd != -1) {
+      close(err_fd);
+    }
+  }
+}
+
+BuiltinRedirection::~BuiltinRedirection() {
+  SmallShell::flushOutput();
+  if (saved_cout != nullptr) cout.rdbuf(saved_cout);
+  if (saved_cerr != nullptr) cerr.rdbuf(saved_cerr);
+  if (err_file != nullptr) {
+    stderr = saved_stderr;
+    fclose(err_file);
+  }
+  redirected_output[0] = redirected_output[1] = nullptr;
+  for (int fd : opened) {
+    close(fd);
+  }
+}
+
+static void _restoreOutput() {
+  SmallShell::flushOutput();
+  cout.rdbuf(cout_buffer);
+}
+
+/**
+* Sends cout through a large buffer that is only written out by flushOutput, which runs before a
+* child is started or waited for, around redirections and at exit.
+*/
+void SmallShell::bufferOutput() {
+  if (output_buffer != nullptr) return;
+  static OutputBuffer buffer(1);
+  output_buffer = &buffer;
+  cout_buffer = cout.rdbuf(output_buffer);
+  atexit(_restoreOutput);
+}
+
+void SmallShell::flushOutput() {
+  for (OutputBuffer* buffer : redirected_output) {
+    if (buffer != nullptr) buffer->flush();
+  }
+  if (output_buffer != nullptr) {
+    output_buffer->flush();
+  }
+}
+
+void SmallShell::changeTitle(const string& title) {
+  this->title = title;
+}
+
+void SmallShell::setLastWD(char* new_lwd) {
+  this->last_wd = string(new_lwd);
+}
+
+SmallShell::~SmallShell() {
+}
+
+shared_ptr<const LoadedBuiltin> SmallShell::findLoadedBuiltin(const string& name) const {
+  auto it = loaded_builtins.find(name);
+  return it == loaded_builtins.end() ? nullptr : it->second;
+}
+
+/**
+* Loads smash_<name> from the shared object at path as the builtin name, replacing an earlier one.
+* Plans parsed before may have taken name for an external command, so the plan cache is cleared.
+*/
+bool SmallShell::loadBuiltin(const string& path, const string& name) {
+  if (_findBuiltin(name.c_str()) != nullptr) {
+    cerr << "smash error: enable: " << name << ": is a shell builtin" << endl;
+    return false;
+  }
+  void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    cerr << "smash error: enable: " << dlerror() << endl;
+    return false;
+  }
+  smash_builtin_t entry = reinterpret_cast<smash_builtin_t>(dlsym(handle, ("smash_" + name).c_str()));
+  if (entry == nullptr) {
+    cerr << "smash error: enable: " << dlerror() << endl;
+    dlclose(handle);
+    return false;
+  }
+  const unsigned* flags = static_cast<const unsigned*>(dlsym(handle, ("smash_" + name + "_flags").c_str()));
+  shared_ptr<LoadedBuiltin> builtin(new LoadedBuiltin());
+  builtin->name = name;
+  builtin->path = path;
+  builtin->handle = handle;
+  builtin->entry = entry;
+  builtin->is_unsafe = flags != nullptr && (*flags & SMASH_BUILTIN_UNSAFE);
+  loaded_builtins[name] = builtin;
+  clearPlanCache();
+  return true;
+}
+
+bool SmallShell::unloadBuiltin(const string& name) {
+  if (loaded_builtins.erase(name) == 0) return false;
+  clearPlanCache();
+  return true;
+}
+
+void SmallShell::printLoadedBuiltins() {
+  for (const auto& entry : loaded_builtins) {
+    cout << "enable -f " << entry.second->path << " " << entry.first
+         << (entry.second->is_unsafe ? " (unsafe)" : "") << endl;
+  }
+}
+
+shared_ptr<Command> SmallShell::CreateCommand(const char* cmd_line) {
+  long long start_ns = Trace::begin();
+  shared_ptr<Command> cmd = CreateCommand(*getPlan(cmd_line));
+  Trace::complete("parse", start_ns);
+  return cmd;
+}
+
+/**
+* Returns the plan of cmd_line, from the cache when the exact same line was seen recently
+*/
+shared_ptr<const CommandPlan> SmallShell::getPlan(const char* cmd_line) {
+  string key(cmd_line);
+  auto it = plan_index.find(key);
+  if (it != plan_index.end()) {
+    plan_hits++;
+    plan_cache.splice(plan_cache.begin(), plan_cache, it->second);
+    return it->second->second;
+  }
+  plan_misses++;
+  shared_ptr<const CommandPlan> plan = _parsePlan(key);
+  if (plan_cache.size() >= PLAN_CACHE_SIZE) {
+    plan_index.erase(plan_cache.back().first);
+    plan_cache.pop_back();
+  }
+  plan_cache.emplace_front(key, plan);
+  plan_index[key] = plan_cache.begin();
+  return plan;
+}
+
+void SmallShell::clearPlanCache() {
+  plan_cache.clear();
+  plan_index.clear();
+  plan_hits = 0;
+  plan_misses = 0;
+}
+
+void SmallShell::printPlanCache() {
+  long long lookups = plan_hits + plan_misses;
+  cout << "hits " << plan_hits << " misses " << plan_misses << " hit rate "
+       << (lookups == 0 ? 0 : plan_hits * 100 / lookups) << "% entries "
+       << plan_cache.size() << "/" << PLAN_CACHE_SIZE << endl;
+}
+
+/**
+* Creates and returns a pointer to Command class which matches the given plan
+*/
+shared_ptr<Command> SmallShell::CreateCommand(const CommandPlan& plan) {
+  switch (plan.kind) {
+    case CommandPlan::PIPE:
+      return shared_ptr<PipeCommand>(new PipeCommand(plan));
+    case CommandPlan::BUILTIN:
+      return shared_ptr<Command>(plan.builtin->create(plan));
+    case CommandPlan::LOADED:
+      return shared_ptr<LoadedCommand>(new LoadedCommand(plan));
+    case CommandPlan::EXTERNAL:
+      return shared_ptr<ExternalCommand>(new ExternalCommand(plan));
+  }
+  return nullptr;
+}
+
+// What stats counts cmd as, from how it runs
+static Stats::Kind _statsKind(const Command* cmd) {
+  if (cmd->policy == CommandPlan::RUN_TIMED) return Stats::TIMEOUT;
+  if (cmd->policy == CommandPlan::RUN_PIPELINE) return Stats::PIPE;
+  if (!cmd->fd_actions.empty()) return Stats::REDIRECT;
+  return cmd->policy == CommandPlan::RUN_IN_CHILD ? Stats::EXTERNAL : Stats::BUILTIN;
+}
+
+/**
+* Runs cmd according to the policy its plan was given, so the command's type is never inspected here
+*/
+void SmallShell::executeCommand(shared_ptr<Command> cmd) {
+  if (cmd == nullptr) return;
+  Stats::commands[_statsKind(cmd.get())].fetch_add(1, std::memory_order_relaxed);
+  job_list.rebalance();
+  vector<pid_t> pids;
+  switch (cmd->policy) {
+    case CommandPlan::RUN_IN_PARENT: {
+      BuiltinRedirection redirection(cmd.get());
+      if (redirection.is_ready) cmd->execute();
+      return;
+    }
+    case CommandPlan::RUN_TIMED:
+      static_cast<TimeoutCommand*>(cmd.get())->timed_execute(cmd);
+      return;
+    case CommandPlan::RUN_WRAPPER:
+      cmd->execute();
+      return;
+    case CommandPlan::RUN_PIPELINE:
+      pids = static_cast<PipeCommand*>(cmd.get())->launch();
+      break;
+    case CommandPlan::RUN_IN_CHILD:
+    case CommandPlan::RUN_FORKED: {
+      pid_t pid = launchCommand(cmd.get(), {});
+      if (pid != -1) pids.push_back(pid);
+      break;
+    }
+  }
+  if (pids.empty()) return;
+  if (cmd->is_background){
+    job_list.removeFinishedJobs();
+    JobsList::JobEntry* job = job_list.addJob(cmd, pids, false);
+    if (job_list.auto_place) job_list.placeJob(job);
+  }
+  else{
+    waitForeground(cmd, pids, 0);
+  }
+}
@@ -1,219 +1,711 @@
-#ifndef SMASH_COMMAND_H_
-#define SMASH_COMMAND_H_
-
-#include <vector>
-#include <time.h>
-#include <map>
-#include <memory>
-
-#define COMMAND_ARGS_MAX_LENGTH (200)
-#define COMMAND_MAX_ARGS (20)
-
-class Command {
- public:
-  const std::string original_cmd_line;
-  std::string cmd_line;
-  char ** args;
-  int num_of_args;
-  bool is_background;
-
-  Command(const char* cmd_line);
-  virtual ~Command();
-  virtual void execute() = 0;
-  virtual void prepare();
-  // virtual void cleanup();
-};
-
-class BuiltInCommand : public Command {
- public:
-  BuiltInCommand(const char* cmd_line);
-  virtual ~BuiltInCommand() {}
-};
-
-class ExternalCommand : public Command {
- public:
-  bool is_complex;
-  ExternalCommand(const char* cmd_line);
-  virtual ~ExternalCommand() {}
-  void execute() override;
-};
-
-class PipeCommand : public Command {
-  std::shared_ptr<Command> first_cmd;
-  std::shared_ptr<Command> second_cmd;
-  bool to_cerr;
- public:
-  PipeCommand(const char* cmd_line);
-  virtual ~PipeCommand() {}
-  void execute() override;
-};
-
-class RedirectionCommand : public Command {
- public:
-  std::string cmd;
-  std::string output_file;
-  bool is_append;
-  explicit RedirectionCommand(const char* cmd_line);
-  virtual ~RedirectionCommand() {}
-  void execute() override;
-  //void prepare() override;
-  //void cleanup() override;
-};
-
-class ChangePrompt : public BuiltInCommand {
-  public:
-    std::string title;
-    ChangePrompt(const char* cmd_line);
-    virtual ~ChangePrompt() {}
-    void execute() override;
-};
-
-class ChangeDirCommand : public BuiltInCommand {
-public:
-  ChangeDirCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {};
-  virtual ~ChangeDirCommand() {}
-  void execute() override;
-};
-
-class GetCurrDirCommand : public BuiltInCommand {
- public:
-  GetCurrDirCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {};
-  virtual ~GetCurrDirCommand() = default;
-  void execute() override;
-};
-
-class ShowPidCommand : public BuiltInCommand {
- public:
-  ShowPidCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {};
-  virtual ~ShowPidCommand() = default;
-  void execute() override;
-};
-
-class JobsList;
-class QuitCommand : public BuiltInCommand {
-public:
-  JobsList* jobs;
-  QuitCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs(jobs) {};
-  virtual ~QuitCommand() {}
-  void execute() override;
-};
-
-
-class JobsList {
- public:
-  class JobEntry {
-    public:
-      int job_id;
-      std::shared_ptr<Command> cmd;
-      pid_t pid;
-      time_t time_started;
-      bool is_stopped;
-      JobEntry(int job_id, std::shared_ptr<Command> cmd, int pid, bool is_stopped = false) : job_id(job_id), cmd(cmd), pid(pid), time_started(time(0)), is_stopped(is_stopped) {}
-      JobEntry(const JobEntry &job_entry) = default;
-      ~JobEntry() = default;
-  };
-  std::vector<JobEntry> jobs;
-  JobsList() = default;
-  ~JobsList() = default;
-  void addJob(std::shared_ptr<Command> cmd, int pid, bool isStopped = false, int job_id = 0);
-  void printJobsList();
-  void killAllJobs();
-  void removeFinishedJobs();
-  JobEntry * getJobById(int jobId);
-  void removeJobById(int jobId);
-  JobEntry * getLastJob(int* lastJobId);
-  JobEntry *getLastStoppedJob(int *jobId);
-};
-
-class TimedJobsList {
-  std::map<time_t, std::vector<std::shared_ptr<JobsList::JobEntry>>> jobs;
-  public:
-  TimedJobsList() = default;
-  ~TimedJobsList() = default;
-  void addTimedJob(time_t end_time, std::shared_ptr<JobsList::JobEntry> job);
-  void handleAlarm();
-};
-
-class JobsCommand : public BuiltInCommand {
- public:
-  JobsList* jobs_list;
-  JobsCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {}
-  virtual ~JobsCommand() {}
-  void execute() override;
-};
-
-class ForegroundCommand : public BuiltInCommand {
- public:
-  JobsList* jobs_list;
-  ForegroundCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {}
-  virtual ~ForegroundCommand() {}
-  void execute() override;
-};
-
-class BackgroundCommand : public BuiltInCommand {
- public:
-  JobsList* jobs_list;
-  BackgroundCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {}
-  virtual ~BackgroundCommand() {}
-  void execute() override;
-};
-
-class TimeoutCommand : public BuiltInCommand {
- public:
-  explicit TimeoutCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
-  virtual ~TimeoutCommand() {}
-  void execute() {}
-  void timed_execute(std::shared_ptr<Command> cmd_ptr);
-};
-
-class FareCommand : public BuiltInCommand {
- public:
-  FareCommand(const char* cmd_line) : BuiltInCommand(cmd_line) {}
-  virtual ~FareCommand() {}
-  void execute() override;
-  static int ReplaceSubStrings(std::string& str, const std::string& from, const std::string& to);
-};
-
-class SetcoreCommand : public BuiltInCommand {
-  int cores;
- public:
-  SetcoreCommand(const char* cmd_line) : BuiltInCommand(cmd_line) , cores(0) {};
-  virtual ~SetcoreCommand() {}
-  void execute() override;
-};
-
-class KillCommand : public BuiltInCommand {
- public:
-  JobsList* jobs_list;
-  KillCommand(const char* cmd_line, JobsList* jobs) : BuiltInCommand(cmd_line), jobs_list(jobs) {}
-  virtual ~KillCommand() {}
-  void execute() override;
-};
-
-class SmallShell {
- private:
-  std::string title;
-  std::string last_wd;
-  SmallShell();
- public:
-  JobsList job_list;
-  TimedJobsList timed_jobs;
-  JobsList::JobEntry* fg_job;
-  std::shared_ptr<Command> CreateCommand(const char* cmd_line);
-  SmallShell(SmallShell const&)      = delete; // disable copy ctor
-  void operator=(SmallShell const&)  = delete; // disable = operator
-  static SmallShell& getInstance() // make SmallShell singleton
-  {
-    static SmallShell instance; // Guaranteed to be destroyed.
-    // Instantiated on first use.
-    return instance;
-  }
-  ~SmallShell();
-  void executeCommand(const char* cmd_line);
-  void changeTitle(const std::string& title);
-  std::string getTitle() const { return title; }
-  std::string getLastWD() const { return last_wd; }
-  void setLastWD(char* new_lwd);
-};
-
-#endif //SMASH_COMMAND_H_
+#ifndef SMASH_COMMAND_H_
+#define SMASH_COMMAND_H_
+
+#include <vector>
+#include <time.h>
+#include <map>
+#include <list>
+#include <deque>
+#include <atomic>
+#include <set>
+#include <unordered_map>
+#include <string>
+#include <memory>
+#include <spawn.h>
+#include <streambuf>
+#include <stdio.h>
+
+// Files above this size are rewritten by fare in FARE_CHUNK_SIZE blocks instead of being mapped whole
+#ifndef FARE_STREAM_THRESHOLD
+#define FARE_STREAM_THRESHOLD (64 * 1024 * 1024)
+#endif
+#ifndef FARE_CHUNK_SIZE
+#define FARE_CHUNK_SIZE (1024 * 1024)
+#endif
+// Files up to this size are read and written by fare with a single call each instead of being mapped
+#ifndef FARE_SMALL_FILE
+#define FARE_SMALL_FILE (64 * 1024)
+#endif
+
+// Number of command lines whose parse SmallShell keeps
+#ifndef PLAN_CACHE_SIZE
+#define PLAN_CACHE_SIZE 256
+#endif
+// Finished jobs kept for jobs -l
+#ifndef JOBS_HISTORY
+#define JOBS_HISTORY 64
+#endif
+// How often, at most, smash moves automatically placed jobs between cores
+#ifndef PLACEMENT_INTERVAL_MS
+#define PLACEMENT_INTERVAL_MS 1000
+#endif
+// Megabytes pipebench moves when not told otherwise
+#ifndef PIPEBENCH_MB
+#define PIPEBENCH_MB 256
+#endif
+// Events the trace ring keeps, a power of two
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 8192
+#endif
+// Size of the cout buffer used when smash runs a script
+#ifndef SMASH_OUTPUT_BUFFER
+#define SMASH_OUTPUT_BUFFER (64 * 1024)
+#endif
+
+// A dup2 (source onto fd), a close of fd, or an open of path onto fd, applied in the child before it runs
+struct FdAction {
+  static const int CLOSE = -1;
+  static const int OPEN = -2;
+  int fd;
+  int source;
+  std::string path;
+  int flags;
+};
+
+/**
+* Ring of the last TRACE_EVENTS timestamped events, filled by trace start and written out as a
+* Chrome trace. Recording takes only atomics and clock_gettime, so signal handlers record too,
+* and costs a single load while tracing is off.
+*/
+class Trace {
+ public:
+  struct Event {
+    // Index + 1 of the event in the slot once it is complete, 0 while it is written
+    std::atomic<unsigned long> seq;
+    const char* name;
+    long long start_ns;
+    // -1 for an instant event
+    long long dur_ns;
+    // The child the event is about, 0 for smash itself
+    pid_t pid;
+    const char* arg_name;
+    long arg;
+  };
+ private:
+  static Event ring[TRACE_EVENTS];
+  static std::atomic<unsigned long> next;
+  static std::atomic<bool> enabled;
+  static void record(const char* name, long long start_ns, long long dur_ns, pid_t pid, const char* arg_name, long arg);
+ public:
+  static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+  static long long now();
+  // Start time to pass to complete(), 0 while tracing is off
+  static long long begin() { return isEnabled() ? now() : 0; }
+  static void complete(const char* name, long long start_ns, pid_t pid = 0, const char* arg_name = nullptr, long arg = 0) {
+    if (start_ns != 0 && isEnabled()) record(name, start_ns, now() - start_ns, pid, arg_name, arg);
+  }
+  static void instant(const char* name, pid_t pid = 0, const char* arg_name = nullptr, long arg = 0) {
+    if (isEnabled()) record(name, now(), -1, pid, arg_name, arg);
+  }
+  static void start();
+  static void stop();
+  static bool dump(const std::string& file_name);
+};
+
+/**
+* Distribution of non-negative values (ns) in log-linear buckets, HDR style: exact below 16, then
+* 16 buckets per power of two, so what it reports is within 1/16 of the real value.
+* Updates are relaxed atomics, so another thread may read it while it is recorded to.
+*/
+class Histogram {
+  static const int SUB_BUCKETS = 16;
+  static const int BUCKETS = SUB_BUCKETS + (63 - 4) * SUB_BUCKETS;
+  std::atomic<unsigned long> counts[BUCKETS];
+  std::atomic<unsigned long> total;
+  std::atomic<long long> sum_ns;
+  std::atomic<long long> max_ns;
+  static int bucketOf(long long value);
+  static long long bucketEnd(int bucket);
+ public:
+  Histogram();
+  void record(long long value);
+  unsigned long count() const { return total.load(std::memory_order_relaxed); }
+  long long sum() const { return sum_ns.load(std::memory_order_relaxed); }
+  long long max() const { return max_ns.load(std::memory_order_relaxed); }
+  // Smallest bucket end below which at least p percent of the values fall
+  long long percentile(double p) const;
+  // Values recorded into buckets that end at or below value
+  unsigned long countUpTo(long long value) const;
+};
+
+/**
+* Counters smash always keeps, printed by stats and optionally exported as a Prometheus text file.
+* The counters are atomics, since signal handlers and the exporter thread use them too.
+*/
+class Stats {
+ public:
+  enum Kind { BUILTIN, EXTERNAL, PIPE, REDIRECT, TIMEOUT, KINDS };
+  static std::atomic<unsigned long> commands[KINDS];
+  static std::atomic<unsigned long> jobs_reaped;
+  static std::atomic<unsigned long> timeouts_fired;
+  static std::atomic<unsigned long> signals_forwarded;
+  // From the start of a launch until fork or posix_spawn returned
+  static Histogram launch_ns;
+  // Time smash spent waiting on a foreground job
+  static Histogram foreground_ns;
+  static void print();
+  static std::string prometheus();
+  // Rewrites file_name every interval seconds from a thread of its own, until the next call
+  static void startExport(const std::string& file_name, int interval);
+  static void stopExport();
+};
+
+// A registered builtin, see SMASH_BUILTINS in Commands.cpp
+struct BuiltinEntry;
+
+/**
+* Entry point of a builtin loaded by enable -f, exported by the shared object as smash_<name>
+* with C linkage. fds are the stdin, stdout and stderr the builtin should use.
+*/
+typedef int (*smash_builtin_t)(int argc, char** argv, const int fds[3]);
+// Bits of the optional `unsigned smash_<name>_flags` export
+#define SMASH_BUILTIN_UNSAFE 1u
+
+// A builtin loaded by enable -f, the shared object is closed once nothing refers to it
+struct LoadedBuiltin {
+  std::string name;
+  std::string path;
+  void* handle;
+  smash_builtin_t entry;
+  // Runs in a forked child instead of inside smash
+  bool is_unsafe;
+  ~LoadedBuiltin();
+};
+
+// What a command line parses into, cached by SmallShell so a repeated line is not parsed again
+struct CommandPlan {
+  enum Kind { PIPE, BUILTIN, LOADED, EXTERNAL };
+  // How SmallShell::executeCommand runs the command: RUN_IN_CHILD execs an external program,
+  // RUN_FORKED runs execute() in a forked child, RUN_WRAPPER runs execute() in smash and leaves
+  // the redirections to the command it wraps
+  enum Policy { RUN_IN_PARENT, RUN_IN_CHILD, RUN_FORKED, RUN_PIPELINE, RUN_TIMED, RUN_WRAPPER };
+  Kind kind;
+  Policy policy;
+  // Set when kind is BUILTIN
+  const BuiltinEntry* builtin;
+  // Set when kind is LOADED
+  std::shared_ptr<const LoadedBuiltin> loaded;
+  std::string original_cmd_line;
+  // Without the background sign
+  std::string cmd_line;
+  bool is_background;
+  // The tokens of cmd_line, NUL-terminated in arena at the given offsets
+  std::string arena;
+  std::vector<size_t> tokens;
+  // Stages of a pipe
+  std::vector<std::shared_ptr<const CommandPlan>> stages;
+  // stderr_to_pipe[i] is set when stage i is followed by |& rather than |
+  std::vector<bool> stderr_to_pipe;
+  // The redirections of a single command, in the order they were written
+  std::vector<FdAction> fd_actions;
+};
+
+class Command {
+ public:
+  const std::string original_cmd_line;
+  std::string cmd_line;
+  char ** args;
+  int num_of_args;
+  bool is_background;
+  const CommandPlan::Policy policy;
+  // What a forked child running execute() exits with
+  int exit_status;
+  // Applied after the pipe's own fds in the child, or emulated through stdio for a builtin run by smash
+  const std::vector<FdAction> fd_actions;
+  // The stdin, stdout and stderr of a builtin run by smash, once its redirections are applied
+  int stdio[3];
+
+  explicit Command(const CommandPlan& plan);
+  Command(const Command&) = delete;
+  virtual ~Command();
+  virtual void execute() = 0;
+  // virtual void cleanup();
+ private:
+  // Backing storage for args: a copy of the plan's tokens
+  std::string arena;
+  std::vector<char*> argv;
+};
+
+class BuiltInCommand : public Command {
+ public:
+  explicit BuiltInCommand(const CommandPlan& plan);
+  virtual ~BuiltInCommand() {}
+};
+
+class ExternalCommand : public Command {
+ public:
+  bool is_complex;
+  bool has_wildcards;
+  std::string exec_path;
+  explicit ExternalCommand(const CommandPlan& plan);
+  virtual ~ExternalCommand() {}
+  void execute() override;
+  pid_t spawn(const posix_spawn_file_actions_t* actions, const posix_spawnattr_t* attr);
+  void expandWildcards();
+ private:
+  // Tokens as typed, and the argv built from them by expandWildcards
+  std::vector<char*> patterns;
+  std::vector<std::string> expanded_args;
+  std::vector<char*> expanded_argv;
+};
+
+class PipeCommand : public Command {
+  std::vector<std::shared_ptr<Command>> stages;
+  std::vector<bool> stderr_to_pipe;
+ public:
+  explicit PipeCommand(const CommandPlan& plan);
+  virtual ~PipeCommand() {}
+  void execute() override;
+  std::vector<pid_t> launch();
+};
+
+class ChangePrompt : public BuiltInCommand {
+  public:
+    std::string title;
+    ChangePrompt(const CommandPlan& plan);
+    virtual ~ChangePrompt() {}
+    void execute() override;
+};
+
+class ChangeDirCommand : public BuiltInCommand {
+public:
+  ChangeDirCommand(const CommandPlan& plan) : BuiltInCommand(plan) {};
+  virtual ~ChangeDirCommand() {}
+  void execute() override;
+};
+
+class GetCurrDirCommand : public BuiltInCommand {
+ public:
+  GetCurrDirCommand(const CommandPlan& plan) : BuiltInCommand(plan) {};
+  virtual ~GetCurrDirCommand() = default;
+  void execute() override;
+};
+
+class ShowPidCommand : public BuiltInCommand {
+ public:
+  ShowPidCommand(const CommandPlan& plan) : BuiltInCommand(plan) {};
+  virtual ~ShowPidCommand() = default;
+  void execute() override;
+};
+
+class JobsList;
+class QuitCommand : public BuiltInCommand {
+public:
+  JobsList* jobs;
+  QuitCommand(const CommandPlan& plan, JobsList* jobs) : BuiltInCommand(plan), jobs(jobs) {};
+  virtual ~QuitCommand() {}
+  void execute() override;
+};
+
+
+// Utilization of each core from /proc/stat, over the time since the previous sample
+class CoreLoad {
+  std::vector<unsigned long long> busy;
+  std::vector<unsigned long long> total;
+  std::vector<double> load;
+  long long sampled_ns;
+ public:
+  CoreLoad() : busy(), total(), load(), sampled_ns(0) {}
+  // Between 0 and 1, indexed by core number
+  const std::vector<double>& sample();
+};
+
+class JobsList {
+ public:
+  class JobEntry {
+    public:
+      int job_id;
+      std::shared_ptr<Command> cmd;
+      pid_t pid;
+      // Processes of the job still running, more than one for a pipeline; pid is the group leader
+      std::vector<pid_t> pids;
+      time_t time_started;
+      bool is_stopped;
+      // Resources of the job's processes reaped so far; kept when it moves between foreground and list
+      struct Usage {
+        // CLOCK_MONOTONIC at start, and once the last process was reaped (0 until then)
+        long long start_ns;
+        long long end_ns;
+        long long user_us;
+        long long sys_us;
+        long max_rss_kb;
+        // Wait status of the last stage, -1 until it is reaped
+        int status;
+        pid_t last_pid;
+        explicit Usage(pid_t last_pid = -1);
+        void add(pid_t pid, int status, const struct rusage& usage);
+      };
+      Usage usage;
+      // Core the job was pinned to by automatic placement, -1 when it was not
+      int core;
+      JobEntry(int job_id, std::shared_ptr<Command> cmd, int pid, bool is_stopped = false) : job_id(job_id), cmd(cmd), pid(pid), pids(1, pid), time_started(time(0)), is_stopped(is_stopped), usage(pid), core(-1) {}
+      JobEntry(int job_id, std::shared_ptr<Command> cmd, const std::vector<pid_t>& pids, bool is_stopped = false) : job_id(job_id), cmd(cmd), pid(pids.front()), pids(pids), time_started(time(0)), is_stopped(is_stopped), usage(pids.back()), core(-1) {}
+      JobEntry(const JobEntry &job_entry) = default;
+      ~JobEntry() = default;
+      int sendSignal(int sig_num) const;
+  };
+  // Jobs indexed by id, plus ordered views for max-id/last-stopped and a pid index for reaping
+  std::unordered_map<int, JobEntry> jobs;
+  std::set<int> job_ids;
+  std::set<int> stopped_ids;
+  std::unordered_map<pid_t, int> pid_index;
+  // The last JOBS_HISTORY jobs that finished, background or foreground, oldest first
+  std::deque<JobEntry> finished;
+  // What the SIGCHLD handler writes to the self-pipe: the child, and when it exited
+  struct ChildEvent {
+    pid_t pid;
+    bool has_exited;
+    long long time_ns;
+  };
+  // Self-pipe written by the SIGCHLD handler, drained by removeFinishedJobs
+  static int child_events[2];
+  // Opt-in (SMASH_PLACEMENT=auto): running background jobs are spread over the least loaded cores
+  bool auto_place;
+  CoreLoad core_load;
+  long long rebalanced_ns;
+  int leastLoadedCore(const JobEntry* moving);
+  JobsList();
+  ~JobsList() = default;
+  static void notifyChildEvent(pid_t pid, bool has_exited);
+  JobEntry* addJob(std::shared_ptr<Command> cmd, const std::vector<pid_t>& pids, bool isStopped = false, int job_id = 0,
+                   const JobEntry::Usage* usage = nullptr);
+  JobEntry* addJob(std::shared_ptr<Command> cmd, int pid, bool isStopped = false, int job_id = 0) {
+    return addJob(cmd, std::vector<pid_t>(1, pid), isStopped, job_id);
+  }
+  void placeJob(JobEntry* job);
+  void releaseJob(JobEntry* job);
+  void rebalance(bool force = false);
+  void printJobsList();
+  void printJobsUsage();
+  void addFinished(const JobEntry& job, long long end_ns = 0);
+  void killAllJobs();
+  void removeFinishedJobs();
+  void setStopped(JobEntry* job, bool is_stopped);
+  void updateJobState(pid_t pid, int status, const struct rusage& usage, long long exit_ns);
+  JobEntry * getJobById(int jobId);
+  void removeJobById(int jobId);
+  JobEntry * getLastJob(int* lastJobId);
+  JobEntry *getLastStoppedJob(int *jobId);
+};
+
+/**
+* Timed jobs in a hierarchical timer wheel: LEVELS levels of 64 slots, level L slots being 64^L
+* milliseconds wide. A monotonic POSIX timer raises SIGALRM at the next expiry.
+*/
+class TimedJobsList {
+  static const int LEVELS = 7;
+  static const int SLOTS = 64;
+  struct TimedEntry {
+    long long expiry;
+    // Reset once the job has exited; the entry stays until it expires, as its alarm is still reported
+    std::shared_ptr<JobsList::JobEntry> job;
+  };
+  std::list<TimedEntry> wheel[LEVELS][SLOTS];
+  unsigned long long occupied[LEVELS];
+  long long slot_min[LEVELS][SLOTS];
+  std::unordered_map<pid_t, std::list<TimedEntry>::iterator> pid_index;
+  // Milliseconds since origin up to which the wheel has been advanced
+  long long current;
+  struct timespec origin;
+  timer_t timer;
+  bool has_timer;
+  long long now() const;
+  void place(std::list<TimedEntry>& from, std::list<TimedEntry>::iterator it, std::list<TimedEntry>& expired);
+  void advance(long long to, std::list<TimedEntry>& expired);
+  long long nextExpiry() const;
+  void rearm();
+  public:
+  TimedJobsList();
+  ~TimedJobsList();
+  void addTimedJob(long long timeout_ms, std::shared_ptr<JobsList::JobEntry> job);
+  void cancelTimedJob(pid_t pid);
+  void handleAlarm();
+};
+
+class JobsCommand : public BuiltInCommand {
+ public:
+  JobsList* jobs_list;
+  JobsCommand(const CommandPlan& plan, JobsList* jobs) : BuiltInCommand(plan), jobs_list(jobs) {}
+  virtual ~JobsCommand() {}
+  void execute() override;
+};
+
+class ForegroundCommand : public BuiltInCommand {
+ public:
+  JobsList* jobs_list;
+  ForegroundCommand(const CommandPlan& plan, JobsList* jobs) : BuiltInCommand(plan), jobs_list(jobs) {}
+  virtual ~ForegroundCommand() {}
+  void execute() override;
+};
+
+class BackgroundCommand : public BuiltInCommand {
+ public:
+  JobsList* jobs_list;
+  BackgroundCommand(const CommandPlan& plan, JobsList* jobs) : BuiltInCommand(plan), jobs_list(jobs) {}
+  virtual ~BackgroundCommand() {}
+  void execute() override;
+};
+
+class TimeCommand : public BuiltInCommand {
+ public:
+  explicit TimeCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~TimeCommand() {}
+  void execute() override;
+};
+
+class TimeoutCommand : public BuiltInCommand {
+ public:
+  explicit TimeoutCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~TimeoutCommand() {}
+  void execute() {}
+  void timed_execute(std::shared_ptr<Command> cmd_ptr);
+};
+
+// The src/dst pairs of one fare run, matched together by an Aho-Corasick automaton
+class FarePatterns {
+  // Dense DFA with stride transitions per state; state 0 is dead and state 1 is the root
+  std::vector<int> delta;
+  unsigned short classes[256];
+  int stride;
+  // Pattern ending at each state (its own or the longest suffix one), -1 for none
+  std::vector<int> out;
+  std::vector<int> depth;
+ public:
+  std::vector<std::string> from;
+  std::vector<std::string> to;
+  FarePatterns() : delta(), classes(), stride(0), out(), depth(), from(), to() {}
+  void add(const std::string& src, const std::string& dst);
+  void compile();
+  const char* find(const char* data, const char* end, bool is_final, int* pattern, const char** tail) const;
+};
+
+class FareCommand : public BuiltInCommand {
+ public:
+  // Outcome of rewriting one file, filled in by a fare worker
+  struct FareResult {
+    std::string file_name;
+    std::vector<size_t> counts;
+    bool is_written;
+    // Name of the call that failed and its errno, nullptr on success
+    const char* failed_call;
+    int error;
+  };
+  FareCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~FareCommand() {}
+  void execute() override;
+  static bool ProcessFile(FareResult& result, const FarePatterns& patterns);
+  static bool ReadMapping(const std::string& file_name, FarePatterns& patterns);
+  static int ReplaceSubStrings(std::string& str, const std::string& from, const std::string& to);
+  static size_t CountSubStrings(const char* data, size_t length, const FarePatterns& patterns,
+                                std::vector<size_t>& counts);
+  static char* ReplaceSubStrings(const char* data, size_t length, const FarePatterns& patterns, char* out);
+  static bool RewriteFile(FareResult& result, int fd, mode_t mode, const char* data, size_t length,
+                          const FarePatterns& patterns);
+  static bool StreamFile(FareResult& result, int fd, mode_t mode, const FarePatterns& patterns);
+};
+
+class SetcoreCommand : public BuiltInCommand {
+ public:
+  SetcoreCommand(const CommandPlan& plan) : BuiltInCommand(plan) {};
+  virtual ~SetcoreCommand() {}
+  void execute() override;
+};
+
+class KillCommand : public BuiltInCommand {
+ public:
+  JobsList* jobs_list;
+  KillCommand(const CommandPlan& plan, JobsList* jobs) : BuiltInCommand(plan), jobs_list(jobs) {}
+  virtual ~KillCommand() {}
+  void execute() override;
+};
+
+class PipeBenchCommand : public BuiltInCommand {
+ public:
+  PipeBenchCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~PipeBenchCommand() {}
+  void execute() override;
+};
+
+class TraceCommand : public BuiltInCommand {
+ public:
+  TraceCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~TraceCommand() {}
+  void execute() override;
+};
+
+class StatsCommand : public BuiltInCommand {
+ public:
+  StatsCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~StatsCommand() {}
+  void execute() override;
+};
+
+class CmdCacheCommand : public BuiltInCommand {
+ public:
+  CmdCacheCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~CmdCacheCommand() {}
+  void execute() override;
+};
+
+class LoadedCommand : public Command {
+  std::shared_ptr<const LoadedBuiltin> builtin;
+ public:
+  explicit LoadedCommand(const CommandPlan& plan);
+  virtual ~LoadedCommand() {}
+  void execute() override;
+};
+
+class EnableCommand : public BuiltInCommand {
+ public:
+  EnableCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~EnableCommand() {}
+  void execute() override;
+};
+
+/**
+* Native versions of common utilities, used instead of the binaries unless SMASH_COREUTILS=external.
+* They report errors the way the binaries do. cat and sleep may block, so they run in a forked child.
+*/
+class EchoCommand : public BuiltInCommand {
+ public:
+  EchoCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~EchoCommand() {}
+  void execute() override;
+};
+
+class TrueCommand : public BuiltInCommand {
+ public:
+  TrueCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~TrueCommand() {}
+  void execute() override {}
+};
+
+class TestCommand : public BuiltInCommand {
+ public:
+  TestCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~TestCommand() {}
+  void execute() override;
+};
+
+class CatCommand : public BuiltInCommand {
+ public:
+  explicit CatCommand(const CommandPlan& plan);
+  virtual ~CatCommand() {}
+  void execute() override;
+};
+
+class SleepCommand : public BuiltInCommand {
+ public:
+  explicit SleepCommand(const CommandPlan& plan);
+  virtual ~SleepCommand() {}
+  void execute() override;
+};
+
+class HashCommand : public BuiltInCommand {
+ public:
+  HashCommand(const CommandPlan& plan) : BuiltInCommand(plan) {}
+  virtual ~HashCommand() {}
+  void execute() override;
+};
+
+// cout buffer for script mode: endl no longer flushes, only flush() writes the buffer out
+class OutputBuffer : public std::streambuf {
+  char buffer[SMASH_OUTPUT_BUFFER];
+  int fd;
+ protected:
+  int overflow(int c) override;
+  int sync() override { return 0; }
+ public:
+  explicit OutputBuffer(int fd);
+  void flush();
+};
+
+/**
+* Applies the redirections of a builtin that smash runs itself for as long as the object lives:
+* cout and cerr write to buffers over the opened files and the command's stdio is set to them.
+* The fds of smash itself are left alone.
+*/
+class BuiltinRedirection {
+ public:
+  // Cleared when a file could not be opened, the command must not run then
+  bool is_ready;
+  explicit BuiltinRedirection(Command* cmd);
+  BuiltinRedirection(const BuiltinRedirection&) = delete;
+  ~BuiltinRedirection();
+ private:
+  std::vector<int> opened;
+  std::unique_ptr<OutputBuffer> buffers[2];
+  std::streambuf* saved_cout;
+  std::streambuf* saved_cerr;
+  FILE* err_file;
+  FILE* saved_stderr;
+};
+
+class SmallShell {
+ private:
+  std::string title;
+  std::string last_wd;
+  bool use_spawn;
+  bool use_native_utils;
+  // Capacity smash gives the pipes of a pipeline, 0 for the kernel default
+  int pipe_size;
+  struct CachedExecutable {
+    std::string path;
+    int hits;
+  };
+  std::map<std::string, CachedExecutable> exec_cache;
+  // $PATH and the mtime of each of its directories, in ns, when exec_cache was filled
+  std::string exec_cache_path;
+  std::vector<std::pair<std::string, long long>> exec_cache_dirs;
+  // LRU cache of parsed lines, most recently used first
+  std::list<std::pair<std::string, std::shared_ptr<const CommandPlan>>> plan_cache;
+  std::unordered_map<std::string, decltype(plan_cache)::iterator> plan_index;
+  long long plan_hits;
+  long long plan_misses;
+  // Builtins loaded by enable -f, by name
+  std::map<std::string, std::shared_ptr<const LoadedBuiltin>> loaded_builtins;
+  void validateExecCache();
+  SmallShell();
+ public:
+  JobsList job_list;
+  TimedJobsList timed_jobs;
+  JobsList::JobEntry* fg_job;
+  // Usage of the last foreground job, whether it finished or was stopped
+  JobsList::JobEntry::Usage fg_usage;
+  std::shared_ptr<const CommandPlan> getPlan(const char* cmd_line);
+  std::shared_ptr<Command> CreateCommand(const CommandPlan& plan);
+  std::shared_ptr<Command> CreateCommand(const char* cmd_line);
+  pid_t launchCommand(Command* cmd, const std::vector<FdAction>& fd_actions, pid_t pgid = 0);
+  void waitForeground(std::shared_ptr<Command> cmd, const std::vector<pid_t>& pids, int job_id,
+                      const JobsList::JobEntry::Usage* usage = nullptr);
+  SmallShell(SmallShell const&)      = delete; // disable copy ctor
+  void operator=(SmallShell const&)  = delete; // disable = operator
+  static SmallShell& getInstance() // make SmallShell singleton
+  {
+    static SmallShell instance; // Guaranteed to be destroyed.
+    // Instantiated on first use.
+    return instance;
+  }
+  ~SmallShell();
+  void executeCommand(const char* cmd_line) { executeCommand(CreateCommand(cmd_line)); }
+  void executeCommand(std::shared_ptr<Command> cmd);
+  void changeTitle(const std::string& title);
+  std::string getTitle() const { return title; }
+  std::string getLastWD() const { return last_wd; }
+  void setLastWD(char* new_lwd);
+  std::string resolveExecutable(const std::string& name);
+  void clearExecCache();
+  void printExecCache();
+  void clearPlanCache();
+  void printPlanCache();
+  bool useNativeUtils() const { return use_native_utils; }
+  int pipeSize() const { return pipe_size; }
+  std::shared_ptr<const LoadedBuiltin> findLoadedBuiltin(const std::string& name) const;
+  bool loadBuiltin(const std::string& path, const std::string& name);
+  bool unloadBuiltin(const std::string& name);
+  void printLoadedBuiltins();
+  void bufferOutput();
+  static void flushOutput();
+};
+
+#endif //SMASH_COMMAND_H_
@@ -1,29 +1,45 @@
-#include <iostream>
-#include <signal.h>
-#include "signals.h"
-#include "Commands.h"
-
-using namespace std;
-
-void ctrlZHandler(int sig_num) {
-  cout << "smash: got ctrl-Z" << endl;
-  JobsList::JobEntry* fg_job = SmallShell::getInstance().fg_job;
-  if (fg_job == nullptr) return;
-  kill(fg_job->pid, SIGSTOP);
-  SmallShell::getInstance().job_list.addJob(fg_job->cmd, fg_job->pid, true, fg_job->job_id);
-  cout << "smash: process " + to_string(fg_job->pid) + " was stopped" << endl;
-}
-
-void ctrlCHandler(int sig_num) {
-  cout << "smash: got ctrl-C" << endl;
-  JobsList::JobEntry* fg_job = SmallShell::getInstance().fg_job;
-  if (fg_job == nullptr) return;
-  kill(fg_job->pid, SIGKILL);
-  cout << "smash: process " + to_string(fg_job->pid) + " was killed" << endl;
-}
-
-void alarmHandler(int sig_num) {
-  cout << "smash: got an alarm" << endl;
-  SmallShell::getInstance().timed_jobs.handleAlarm();
-}
-
+#include <iostream>
+#include <signal.h>
+#include "signals.h"
+#include "Commands.h"
+
+using namespace std;
+
+void ctrlZHandler(int sig_num) {
+  long long start_ns = Trace::begin();
+  cout << "smash: got ctrl-Z" << endl;
+  JobsList::JobEntry* fg_job = SmallShell::getInstance().fg_job;
+  if (fg_job != nullptr) {
+    fg_job->sendSignal(SIGSTOP);
+    SmallShell::getInstance().job_list.addJob(fg_job->cmd, fg_job->pids, true, fg_job->job_id, &fg_job->usage);
+    cout << "smash: process " + to_string(fg_job->pid) + " was stopped" << endl;
+  }
+  Trace::complete("SIGTSTP", start_ns, fg_job == nullptr ? 0 : fg_job->pid);
+}
+
+void ctrlCHandler(int sig_num) {
+  long long start_ns = Trace::begin();
+  cout << "smash: got ctrl-C" << endl;
+  JobsList::JobEntry* fg_job = SmallShell::getInstance().fg_job;
+  if (fg_job != nullptr) {
+    fg_job->sendSignal(SIGKILL);
+    cout << "smash: process " + to_string(fg_job->pid) + " was killed" << endl;
+  }
+  Trace::complete("SIGINT", start_ns, fg_job == nullptr ? 0 : fg_job->pid);
+}
+
+void alarmHandler(int sig_num) {
+  long long start_ns = Trace::begin();
+  cout << "smash: got an alarm" << endl;
+  SmallShell::getInstance().timed_jobs.handleAlarm();
+  Trace::complete("SIGALRM", start_ns);
+}
+
+void childHandler(int sig_num, siginfo_t* info, void* context) {
+  bool has_exited = info->si_code == CLD_EXITED || info->si_code == CLD_KILLED || info->si_code == CLD_DUMPED;
+  JobsList::notifyChildEvent(info->si_pid, has_exited);
+}
+
+void fileSizeHandler(int sig_num) {
+  // Nothing to do, catching SIGXFSZ lets an oversized write fail with EFBIG instead of killing smash
+}
@@ -1,8 +1,12 @@
-#ifndef SMASH__SIGNALS_H_
-#define SMASH__SIGNALS_H_
-
-void ctrlZHandler(int sig_num);
-void ctrlCHandler(int sig_num);
-void alarmHandler(int sig_num);
-
-#endif //SMASH__SIGNALS_H_
+#ifndef SMASH__SIGNALS_H_
+#define SMASH__SIGNALS_H_
+
+#include <signal.h>
+
+void ctrlZHandler(int sig_num);
+void ctrlCHandler(int sig_num);
+void alarmHandler(int sig_num);
+void childHandler(int sig_num, siginfo_t* info, void* context);
+void fileSizeHandler(int sig_num);
+
+#endif //SMASH__SIGNALS_H_
@@ -1,34 +1,111 @@
-#include <iostream>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <signal.h>
-#include "Commands.h"
-#include "signals.h"
-
-int main(int argc, char* argv[]) {
-    if(signal(SIGTSTP , ctrlZHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-Z handler");
-    }
-    if(signal(SIGINT , ctrlCHandler)==SIG_ERR) {
-        perror("smash error: failed to set ctrl-C handler");
-    }
-    struct sigaction sa;
-    sa.sa_handler = alarmHandler;
-    sa.sa_flags = SA_RESTART;
-    if(sigaction(SIGALRM , &sa, nullptr) == -1) {
-        perror("smash error: failed to set SIGALRM handler");
-    }
-
-    SmallShell& smash = SmallShell::getInstance();
-    while(true) {
-        std::cout << smash.getTitle() << "> ";
-        std::string cmd_line;
-        std::getline(std::cin, cmd_line);
-        if(cmd_line.compare("") == 0){
-            continue;
-        }
-        smash.job_list.removeFinishedJobs();
-        smash.executeCommand(cmd_line.c_str());
-    }
-    return 0;
+#include <iostream>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include "Commands.h"
+#include "signals.h"
+
+// Splits commands into lines, read from fd in large blocks, or taken from a string when fd is -1
+class LineReader {
+  int fd;
+  std::string data;
+  size_t start;
+ public:
+  LineReader(int fd, const std::string& commands) : fd(fd), data(commands), start(0) {}
+  bool next(std::string& line) {
+    while (true) {
+      size_t end = data.find('\n', start);
+      if (end != std::string::npos) {
+        line.assign(data, start, end - start);
+        start = end + 1;
+        return true;
+      }
+      data.erase(0, start);
+      start = 0;
+      char buf[64 * 1024];
+      ssize_t bytes_read = fd == -1 ? 0 : read(fd, buf, sizeof(buf));
+      if (bytes_read == -1 && errno == EINTR) continue;
+      if (bytes_read <= 0) {
+        // The last line may not end with a newline
+        line.swap(data);
+        data.clear();
+        return !line.empty();
+      }
+      data.append(buf, bytes_read);
+    }
+  }
+};
+
+int main(int argc, char* argv[]) {
+    if(signal(SIGTSTP , ctrlZHandler)==SIG_ERR) {
+        perror("smash error: failed to set ctrl-Z handler");
+    }
+    if(signal(SIGINT , ctrlCHandler)==SIG_ERR) {
+        perror("smash error: failed to set ctrl-C handler");
+    }
+    struct sigaction sa;
+    sa.sa_handler = alarmHandler;
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGALRM , &sa, nullptr) == -1) {
+        perror("smash error: failed to set SIGALRM handler");
+    }
+
+    struct sigaction fsize_sa;
+    fsize_sa.sa_handler = fileSizeHandler;
+    sigemptyset(&fsize_sa.sa_mask);
+    fsize_sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGXFSZ , &fsize_sa, nullptr) == -1) {
+        perror("smash error: failed to set SIGXFSZ handler");
+    }
+
+    SmallShell& smash = SmallShell::getInstance();
+    struct sigaction child_sa;
+    child_sa.sa_sigaction = childHandler;
+    sigemptyset(&child_sa.sa_mask);
+    child_sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    if(sigaction(SIGCHLD , &child_sa, nullptr) == -1) {
+        perror("smash error: failed to set SIGCHLD handler");
+    }
+
+    // smash -c "<commands>" and smash <script> run without a prompt and with buffered output
+    int input_fd = 0;
+    std::string commands;
+    bool is_script = argc > 1;
+    if (is_script && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            std::cerr << "smash error: -c: invalid arguments" << std::endl;
+            return 1;
+        }
+        input_fd = -1;
+        commands = argv[2];
+    }
+    else if (is_script) {
+        input_fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (input_fd == -1) {
+            perror("smash error: open failed");
+            return 1;
+        }
+    }
+    if (is_script) {
+        smash.bufferOutput();
+    }
+    LineReader reader(input_fd, commands);
+    std::string cmd_line;
+    while(true) {
+        if (!is_script) {
+            std::cout << smash.getTitle() << "> " << std::flush;
+        }
+        if (!reader.next(cmd_line)) {
+            break;
+        }
+        if(cmd_line.compare("") == 0){
+            continue;
+        }
+        smash.job_list.removeFinishedJobs();
+        smash.executeCommand(cmd_line.c_str());
+    }
+    return 0;
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <sys/wait.h>
+#include "Commands.h"
+
+using namespace std;
+
+int _parseCommandLine(std::string& arena, std::vector<char*>& argv);
+
+// Discards everything written to it, so printing cost is measured without the terminal
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Keeps results alive so the compiler cannot drop the work that produced them
+static volatile size_t sink;
+
+static double elapsedUs(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+static double elapsedNs(chrono::steady_clock::time_point start, int iterations) {
+  return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+}
+
+// Writes the members of one JSON object, separated by commas
+class JsonObject {
+  ostream& out;
+  bool is_first;
+ public:
+  JsonObject(ostream& out, const string& indent) : out(out), is_first(true) { out << indent << "{"; }
+  ~JsonObject() { out << "}"; }
+  JsonObject& field(const string& name, double value) {
+    out << (is_first ? "" : ", ") << "\"" << name << "\": " << value;
+    is_first = false;
+    return *this;
+  }
+};
+
+static void benchParse(ostream& out) {
+  const int iterations = 100000;
+  string line = "ls -l --color=never /usr/bin /usr/lib /tmp";
+  vector<char*> argv;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    string arena = line;
+    sink = _parseCommandLine(arena, argv);
+  }
+  double tokenize_ns = elapsedNs(start, iterations);
+
+  // Distinct lines miss the plan cache every time, the same line hits it
+  SmallShell& smash = SmallShell::getInstance();
+  vector<string> lines;
+  for (int i = 0; i < iterations; i++) {
+    lines.push_back("ls -l /tmp/file" + to_string(i) + " > out" + to_string(i % 7) + " 2>&1");
+  }
+  smash.clearPlanCache();
+  start = chrono::steady_clock::now();
+  for (const string& distinct : lines) {
+    sink = smash.getPlan(distinct.c_str())->tokens.size();
+  }
+  double miss_ns = elapsedNs(start, iterations);
+
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    sink = smash.getPlan(line.c_str())->tokens.size();
+  }
+  double hit_ns = elapsedNs(start, iterations);
+
+  JsonObject(out, "").field("tokenize_ns", tokenize_ns).field("plan_miss_ns", miss_ns).field("plan_hit_ns", hit_ns);
+}
+
+static void benchDispatch(ostream& out) {
+  const int iterations = 100000;
+  SmallShell& smash = SmallShell::getInstance();
+  const char* lines[] = {"showpid", "ls -l /tmp", "ls /tmp | wc -l"};
+  const char* names[] = {"create_builtin_ns", "create_external_ns", "create_pipe_ns"};
+  JsonObject object(out, "");
+  for (int kind = 0; kind < 3; kind++) {
+    shared_ptr<const CommandPlan> plan = smash.getPlan(lines[kind]);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      sink = smash.CreateCommand(*plan)->num_of_args;
+    }
+    object.field(names[kind], elapsedNs(start, iterations));
+  }
+}
+
+static void benchJobsList(ostream& out, int n) {
+  shared_ptr<Command> cmd = SmallShell::getInstance().CreateCommand("sleep 100&");
+  JobsList list;
+  const pid_t base_pid = 1 << 22;
+
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    list.addJob(cmd, base_pid + i, i % 3 == 0);
+  }
+  double add_us = elapsedUs(start);
+
+  const int lookups = 10000;
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < lookups; i++) {
+    if (list.getJobById(1 + rand() % n) == nullptr) abort();
+  }
+  double lookup_us = elapsedUs(start) / lookups;
+
+  int id;
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < lookups; i++) {
+    list.getLastJob(&id);
+    list.getLastStoppedJob(&id);
+  }
+  double last_us = elapsedUs(start) / lookups;
+
+  NullBuffer null_buffer;
+  streambuf* old_cout = cout.rdbuf(&null_buffer);
+  start = chrono::steady_clock::now();
+  list.printJobsList();
+  double print_us = elapsedUs(start);
+  cout.rdbuf(old_cout);
+
+  // fg pattern: fetch the last job, drop it, then re-add it as stopped (ctrl-Z)
+  start = chrono::steady_clock::now();
+  for (int i = 0; i < lookups; i++) {
+    JobsList::JobEntry* job = list.getLastJob(&id);
+    pid_t pid = job->pid;
+    list.removeJobById(id);
+    list.addJob(cmd, pid, true, id);
+  }
+  double fg_us = elapsedUs(start) / lookups;
+
+  start = chrono::steady_clock::now();
+  for (int i = 1; i <= n; i++) {
+    list.removeJobById(i);
+  }
+  double remove_us = elapsedUs(start);
+
+  JsonObject(out, "    ").field("jobs", n).field("add_total_us", add_us).field("lookup_us", lookup_us)
+      .field("last_us", last_us).field("fg_cycle_us", fg_us).field("print_us", print_us)
+      .field("remove_total_us", remove_us);
+}
+
+// Text with a hit every ~200 bytes for each of the patterns
+static void benchFare(ostream& out, size_t megabytes, size_t pattern_count) {
+  FarePatterns patterns;
+  for (size_t i = 0; i < pattern_count; i++) {
+    patterns.add("pattern" + to_string(i), "replacement" + to_string(i));
+  }
+  patterns.compile();
+  string data;
+  data.reserve(megabytes << 20);
+  for (size_t i = 0; data.size() < (megabytes << 20); i++) {
+    data += "the quick brown fox jumps over the lazy dog ";
+    if (i % 4 == 0) data += patterns.from[i / 4 % pattern_count] + " ";
+  }
+
+  vector<size_t> counts;
+  auto start = chrono::steady_clock::now();
+  size_t count = FareCommand::CountSubStrings(data.data(), data.size(), patterns, counts);
+  double count_us = elapsedUs(start);
+
+  size_t result_size = data.size();
+  for (size_t i = 0; i < pattern_count; i++) {
+    result_size += counts[i] * patterns.to[i].size();
+    result_size -= counts[i] * patterns.from[i].size();
+  }
+  vector<char> result(result_size);
+  start = chrono::steady_clock::now();
+  sink = FareCommand::ReplaceSubStrings(data.data(), data.size(), patterns, result.data()) - result.data();
+  double replace_us = elapsedUs(start);
+
+  JsonObject(out, "    ").field("mb", megabytes).field("patterns", pattern_count).field("matches", count)
+      .field("count_mb_per_s", megabytes / (count_us / 1e6))
+      .field("replace_mb_per_s", megabytes / (replace_us / 1e6));
+}
+
+// Average time from starting a child to reaping it
+static double launchToExitUs(const char* cmd_line, int iterations) {
+  SmallShell& smash = SmallShell::getInstance();
+  shared_ptr<Command> cmd = smash.CreateCommand(cmd_line);
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    pid_t pid = smash.launchCommand(cmd.get(), {});
+    if (pid == -1) return -1;
+    waitpid(pid, nullptr, 0);
+  }
+  return elapsedUs(start) / iterations;
+}
+
+static void benchLaunch(ostream& out) {
+  const int iterations = 500;
+  // An external program goes through posix_spawn (or fork+exec with SMASH_LAUNCH=fork), a forked
+  // builtin through fork alone. The child flushes what it inherited buffered, so nothing may be pending.
+  out.flush();
+  cout.flush();
+  double external_us = launchToExitUs("/bin/true", iterations);
+  double forked_us = launchToExitUs("sleep 0", iterations);
+  JsonObject(out, "").field("external_exit_us", external_us).field("forked_builtin_exit_us", forked_us);
+}
+
+/**
+* Writes one JSON document with the timings of the paths smash depends on, to the file given
+* as the only argument or to stdout.
+*/
+int main(int argc, char* argv[]) {
+  ofstream file;
+  if (argc > 1) {
+    file.open(argv[1]);
+    if (!file) {
+      perror("smash_bench: open failed");
+      return 1;
+    }
+  }
+  ostream& out = argc > 1 ? file : cout;
+  out << "{\n  \"compiler\": \"" << __VERSION__ << "\",\n";
+  // First, while the process is as small as a shell's, since fork cost grows with its memory
+  out << "  \"launch\": ";
+  benchLaunch(out);
+  out << ",\n  \"parse\": ";
+  benchParse(out);
+  out << ",\n  \"dispatch\": ";
+  benchDispatch(out);
+  out << ",\n  \"jobs_list\": [\n";
+  vector<int> sizes = {10, 1000, 10000, 100000};
+  for (size_t i = 0; i < sizes.size(); i++) {
+    benchJobsList(out, sizes[i]);
+    out << (i + 1 < sizes.size() ? ",\n" : "\n");
+  }
+  out << "  ],\n  \"fare\": [\n";
+  benchFare(out, 4, 1);
+  out << ",\n";
+  benchFare(out, 16, 1);
+  out << ",\n";
+  benchFare(out, 16, 16);
+  out << "\n  ]\n}" << endl;
+  return 0;
+}
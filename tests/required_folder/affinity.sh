@@ -0,0 +1,10 @@
+#!/bin/bash
+# Prints how many threads of the newest python process running $1 are allowed each CPU list, then
+# the NUMA nodes its memory is on. With a node number as $2, that node's CPU list shows as "node N".
+pid=$(pgrep -n -f "python.*$1")
+lists=$(grep -h Cpus_allowed_list /proc/$pid/task/*/status | cut -f2)
+if [ -n "$2" ]; then
+    lists=$(echo "$lists" | sed "s/^$(cat /sys/devices/system/node/node$2/cpulist)\$/node $2/")
+fi
+echo "$lists" | sort | uniq -c
+grep -o ' N[0-9]*=' /proc/$pid/numa_maps | sort -u | tr -d ' ='
@@ -0,0 +1,24 @@
+// Builtins for smash's enable -f, built with: gcc -shared -fPIC -o loadable.so loadable.c
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void put(int fd, const char* s) {
+  write(fd, s, strlen(s));
+}
+
+// Prints its arguments, runs inside smash
+int smash_say(int argc, char** argv, const int fds[3]) {
+  for (int i = 1; i < argc; i++) {
+    put(fds[1], argv[i]);
+    put(fds[1], i + 1 < argc ? " " : "\n");
+  }
+  return 0;
+}
+
+// Exits the process it runs in, so it must run in a forked child
+unsigned smash_bye_flags = 1;
+int smash_bye(int argc, char** argv, const int fds[3]) {
+  put(fds[1], "bye\n");
+  exit(1);
+}
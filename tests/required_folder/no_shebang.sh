@@ -0,0 +1,2 @@
+# No #! line, so this runs only through /bin/sh
+echo "no shebang: $0 $*"
@@ -0,0 +1,8 @@
+#!/usr/bin/env python3
+# Idles in four threads, so setcore has more than one TID to pin
+import threading
+import time
+
+for _ in range(3):
+    threading.Thread(target=time.sleep, args=(100,), daemon=True).start()
+time.sleep(100)
@@ -21,7 +21,9 @@ PID_EXTRACTOR_REGEX = r"(signal number \d+ was sent to pid (\d+)\n)|"\
     "(process (\d+) was stopped\n)|"\
     "(process (\d+) was killed\n)|"\
     "(signal number \d was sent to pid (\d+)\n)|"\
-    "(smash> .* : (\d+)\n)"  # fg/bg
+    "(\[[-\d]+\] .* : (\d+) (?:running|stopped|exit|signal|status).*\n)|"\
+    "(smash> .* : (\d+)\n)"  # fg/bg, jobs -l above
+USAGE_REGEX = r"\b(real|user|sys|maxrss) \d+(?:\.\d+)?(?:s|KB)"
 TIMEZONE_REGEX = r"(\d\d\d\d-\d\d-\d\d \d\d:\d\d:\d\d\.\d+ \+)(\d+)"
 
 
@@ -57,6 +59,7 @@ def clean_file(fname, pids):
                 for real, fake in pids.items():
                     line = line.replace(real, fake)
                 line = re.sub(TIMEZONE_REGEX, r"\1XXXX", line)
+                line = re.sub(USAGE_REGEX, r"\1 X", line)
                 f_out.write(line)
 
 
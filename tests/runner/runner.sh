@@ -37,6 +37,10 @@ for test in $TESTS_GLOB; do
     if [ "$test" = "test_fare" ]; then
         ulimit -S -f 4
     fi
+    # test_hash changes a directory on its PATH
+    if [ "$test" = "test_hash" ]; then
+        export PATH=$TMP_FOLDER/hashbin:$PATH
+    fi
     if [ $VALGRIND -eq 0 ] ; then 
         $RUNNER $SMASH < $TESTS_INPUT/$test.txt > $TESTS_OUTPUT/$test.out 2>$TESTS_OUTPUT/$test.err &
     else
@@ -47,6 +51,9 @@ for test in $TESTS_GLOB; do
     if [ "$test" = "test_fare" ]; then
         ulimit unlimited
     fi
+    if [ "$test" = "test_hash" ]; then
+        export PATH=${PATH#$TMP_FOLDER/hashbin:}
+    fi
 done
 
 echo ""